@@ -0,0 +1,583 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <list>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+
+#include <gsl/gsl_matrix.h>
+#include <gsl/gsl_vector.h>
+#include <gsl/gsl_linalg.h>
+#include <gsl/gsl_machine.h>
+
+// solvers for the least squares fit of the bezier triangles (selected in imgui)
+enum bezier_solver_type { bezier_solver_svd, bezier_solver_projection, bezier_solver_normal_equations, bezier_solver_batched, bezier_solver_single_precision };
+
+// the solver a per triangle fit really runs: the svd and projection solvers are unweighted (the projections are shared by all
+// boxes with one pixel layout), so weighted fits (saliency) use the normal equations, and sampled pixels have no shared layout
+inline bezier_solver_type effective_bezier_solver(bezier_solver_type solver, bool use_saliency, bool sampling)
+{
+    bool unweighted_solver = solver == bezier_solver_svd || solver == bezier_solver_projection || solver == bezier_solver_batched;
+    if (use_saliency && unweighted_solver) { return bezier_solver_normal_equations; }
+    if (sampling && (solver == bezier_solver_projection || solver == bezier_solver_batched)) { return bezier_solver_svd; }
+    return solver;
+}
+
+// how many triangles of the last single precision fit needed the double precision fallback (see solve_single_precision)
+struct single_precision_report
+{
+    int num_fits = 0;
+    int num_fallbacks = 0;
+};
+
+const int bezier_max_degree = 4; // biquartic (15 control points, one uniform buffer per control point)
+
+//  ---------------------------------------------------------------------------------------------------------
+// | simple factorial funciton that only accepts number >= 0 and returns the mathematical expression number! |
+//  ---------------------------------------------------------------------------------------------------------
+constexpr int fact(int n)
+{
+    return (n <= 0) ? 1 : n * fact(n-1);
+}
+
+//  ---------------------------------------------------------------------------------------------------------------------
+// | multinomial coefficients n! / (i! j! k!) of the bernstein basis polynomials of degree n, generated at compile time |
+// | in the order of the control points (i = power of s, j = power of t, k = n - i - j: for i, for j) as used by the     |
+// | shader, which gets the same tables (see bezier_glsl_tables)                                                         |
+//  ---------------------------------------------------------------------------------------------------------------------
+template <int n>
+struct bezier_multinomials
+{
+    static constexpr int num_params = (n + 1) * (n + 2) / 2;
+    float values[num_params];
+
+    constexpr bezier_multinomials() : values()
+    {
+        int index = 0;
+        for (int i = 0; i <= n; ++i)
+        {
+            for (int j = 0; i+j <= n; ++j)
+            {
+                values[index] = (float)fact(n) / (float)(fact(i) * fact(j) * fact(n - i - j));
+                ++index;
+            }
+        }
+    }
+};
+template <int n>
+constexpr bezier_multinomials<n> bezier_multinomial_table{};
+
+//  ---------------------------------------------------------------------------------------------------------------------
+// | degree elevation from degree m to degree n >= m: every bernstein polynomial of degree m is a fixed combination of   |
+// | the ones of degree n (multiply by (s + t + u)^(n - m) = 1), B_m = E B_n with                                        |
+// | E[(i, j, k)][(i + a, j + b, k + c)] = (m! / (i! j! k!)) ((n - m)! / (a! b! c!)) / (n! / ((i + a)! (j + b)! (k + c)!)) |
+//  ---------------------------------------------------------------------------------------------------------------------
+template <int m, int n>
+struct bezier_elevation
+{
+    static constexpr int num_params_m = (m + 1) * (m + 2) / 2;
+    static constexpr int num_params_n = (n + 1) * (n + 2) / 2;
+    double values[num_params_m][num_params_n];
+
+    constexpr bezier_elevation() : values()
+    {
+        int index = 0;
+        for (int i = 0; i <= m; ++i)
+        {
+            for (int j = 0; i+j <= m; ++j)
+            {
+                int k = m - i - j;
+                for (int a = 0; a <= n - m; ++a)
+                {
+                    for (int b = 0; a+b <= n - m; ++b)
+                    {
+                        int c = n - m - a - b;
+                        // index of (i + a, j + b) in the control point order of degree n
+                        int index_n = (i + a) * (n + 1) - (i + a) * (i + a - 1) / 2 + j + b;
+                        values[index][index_n] = ((double)fact(m) / (double)(fact(i) * fact(j) * fact(k)))
+                                               * ((double)fact(n - m) / (double)(fact(a) * fact(b) * fact(c)))
+                                               * ((double)(fact(i + a) * fact(j + b) * fact(k + c)) / (double)fact(n));
+                    }
+                }
+                ++index;
+            }
+        }
+    }
+};
+template <int m, int n>
+constexpr bezier_elevation<m, n> bezier_elevation_table{};
+
+//  -----------------------------------------------------------------------------------------------------------------------
+// | values of the (n + 1) * (n + 2) / 2 bernstein basis polynomials of degree n at barycentric coordinate (s, t, u)       |
+// | in the order of the control points; the powers are built up by multiplication (once per pixel, not once per term)    |
+//  -----------------------------------------------------------------------------------------------------------------------
+template <int n>
+inline void bezier_basis(float s, float t, float u, double basis[])
+{
+    double s_pow[n + 1], t_pow[n + 1], u_pow[n + 1];
+    s_pow[0] = t_pow[0] = u_pow[0] = 1.0;
+    for (int e = 1; e <= n; ++e)
+    {
+        s_pow[e] = s_pow[e - 1] * s;
+        t_pow[e] = t_pow[e - 1] * t;
+        u_pow[e] = u_pow[e - 1] * u;
+    }
+    int index = 0;
+    for (int i = 0; i <= n; ++i)
+    {
+        for (int j = 0; i+j <= n; ++j)
+        {
+            basis[index] = bezier_multinomial_table<n>.values[index] * s_pow[i] * t_pow[j] * u_pow[n - i - j];
+            ++index;
+        }
+    }
+}
+inline void bezier_basis(int n, float s, float t, float u, double basis[])
+{
+    switch (n)
+    {
+        case 0: bezier_basis<0>(s, t, u, basis); break;
+        case 1: bezier_basis<1>(s, t, u, basis); break;
+        case 2: bezier_basis<2>(s, t, u, basis); break;
+        case 3: bezier_basis<3>(s, t, u, basis); break;
+        case 4: bezier_basis<4>(s, t, u, basis); break;
+    }
+}
+
+//  -----------------------------------------------------------------------------------------------------------------------
+// | glsl declarations of the multinomial tables of degree 0 up to bezier_max_degree, inserted in the fragment shader     |
+// | (see Shader); bezier_multinomial[bezier_table_offset[n] + index] is the coefficient of control point index of degree n |
+//  -----------------------------------------------------------------------------------------------------------------------
+inline std::string bezier_glsl_tables()
+{
+    std::string offsets;
+    std::string values;
+    int num_values = 0;
+    auto add_degree = [&](int n, const float* multinomials)
+    {
+        offsets += ((n == 0) ? "" : ", ") + std::to_string(num_values);
+        for (int index = 0; index < (n + 1) * (n + 2) / 2; ++index)
+        {
+            values += ((num_values == 0) ? "" : ", ") + std::to_string((int)multinomials[index]) + ".0";
+            ++num_values;
+        }
+    };
+    add_degree(0, bezier_multinomial_table<0>.values);
+    add_degree(1, bezier_multinomial_table<1>.values);
+    add_degree(2, bezier_multinomial_table<2>.values);
+    add_degree(3, bezier_multinomial_table<3>.values);
+    add_degree(4, bezier_multinomial_table<4>.values);
+    static_assert(bezier_max_degree == 4, "add the new degrees to bezier_glsl_tables and bezier_basis");
+
+    std::string num_degrees = std::to_string(bezier_max_degree + 1);
+    return "// bernstein multinomial coefficients (generated by bezier_glsl_tables in bezier.h)\n"
+           "const int bezier_max_degree = " + std::to_string(bezier_max_degree) + ";\n"
+           "const int bezier_table_offset[" + num_degrees + "] = int[" + num_degrees + "](" + offsets + ");\n"
+           "const float bezier_multinomial[" + std::to_string(num_values) + "] = float[" + std::to_string(num_values) + "](" + values + ");\n";
+}
+
+//  --------------------------------------------------------------------------------------------------------------------------
+// | least squares projection operator of one triangle layout: P = pinv(X) with X the (num_pixels x num_params) design matrix |
+// | of the pixels of the triangle, so the best fit control points of a color channel are a matrix vector product P * y       |
+// | small singular values (relative to the largest) are truncated like gsl_multifit_linear does                              |
+//  --------------------------------------------------------------------------------------------------------------------------
+struct bezier_projection
+{
+    int num_params = 0;
+    int num_pixels = 0;
+    std::vector<double> pinv; // num_params x num_pixels (row major)
+    std::vector<double> gram; // X^T X (num_params x num_params), for the squared error of a fit (see squared_error)
+
+    template <typename bary_container>
+    bezier_projection(int n, const bary_container& bary_coords)
+    {
+        num_params = (n + 1) * (n + 2) / 2;
+        num_pixels = (int)bary_coords.size();
+        pinv.assign((size_t)num_params * num_pixels, 0.0);
+        gram.assign((size_t)num_params * num_params, 0.0);
+        if (num_pixels == 0) { return; }
+
+        // svd of the tall one of X and X^T (gsl needs rows >= columns); X = U S V^T -> pinv(X) = V S^-1 U^T
+        bool tall = num_pixels >= num_params;
+        int rows = (tall) ? num_pixels : num_params;
+        int cols = (tall) ? num_params : num_pixels;
+        gsl_matrix* A = gsl_matrix_alloc(rows, cols);
+        gsl_matrix* V = gsl_matrix_alloc(cols, cols);
+        gsl_vector* S = gsl_vector_alloc(cols);
+        gsl_vector* work = gsl_vector_alloc(cols);
+
+        std::vector<double> basis(num_params);
+        for (int p = 0; p < num_pixels; ++p)
+        {
+            bezier_basis(n, bary_coords[p].s, bary_coords[p].t, bary_coords[p].u, basis.data());
+            for (int i = 0; i < num_params; ++i)
+            {
+                if (tall) { gsl_matrix_set(A, p, i, basis[i]); }
+                else { gsl_matrix_set(A, i, p, basis[i]); }
+                for (int j = 0; j < num_params; ++j) { gram[i * num_params + j] += basis[i] * basis[j]; }
+            }
+        }
+        gsl_linalg_SV_decomp(A, V, S, work);
+
+        double tolerance = GSL_DBL_EPSILON * gsl_vector_get(S, 0);
+        for (int i = 0; i < cols; ++i)
+        {
+            double singular_value = gsl_vector_get(S, i);
+            if (singular_value <= tolerance) { continue; }
+            for (int param = 0; param < num_params; ++param)
+            {
+                // tall: pinv = V S^-1 U^T (U = A); wide (X^T = U S V^T): pinv = U S^-1 V^T
+                double left = (tall) ? gsl_matrix_get(V, param, i) : gsl_matrix_get(A, param, i);
+                if (left == 0.0) { continue; }
+                left /= singular_value;
+                double* row = &pinv[(size_t)param * num_pixels];
+                for (int p = 0; p < num_pixels; ++p)
+                {
+                    row[p] += left * ((tall) ? gsl_matrix_get(A, p, i) : gsl_matrix_get(V, p, i));
+                }
+            }
+        }
+
+        gsl_vector_free(work);
+        gsl_vector_free(S);
+        gsl_matrix_free(V);
+        gsl_matrix_free(A);
+    }
+
+    // control points of all 3 color channels of the pixels (same order as the bary_coords the projection was made with)
+    // returns the squared error of the fit (summed over the channels, colors in the range [0, 1])
+    template <typename pixel_container>
+    double apply(const pixel_container& pixels, float** triangle_colors, int triangle_colors_base) const
+    {
+        double control_points[3][15];
+        for (int param = 0; param < num_params; ++param)
+        {
+            const double* row = &pinv[(size_t)param * num_pixels];
+            double sum[3] = {0.0, 0.0, 0.0};
+            for (int p = 0; p < num_pixels; ++p)
+            {
+                sum[0] += row[p] * (pixels[p].color[0] / 255.0f);
+                sum[1] += row[p] * (pixels[p].color[1] / 255.0f);
+                sum[2] += row[p] * (pixels[p].color[2] / 255.0f);
+            }
+            for (int c = 0; c < 3; ++c)
+            {
+                triangle_colors[param][triangle_colors_base + c] = (float)sum[c];
+                control_points[c][param] = sum[c];
+            }
+        }
+
+        double yty = 0.0;
+        for (int p = 0; p < num_pixels; ++p)
+        {
+            for (int c = 0; c < 3; ++c) { yty += (pixels[p].color[c] / 255.0f) * (pixels[p].color[c] / 255.0f); }
+        }
+        return squared_error(yty, control_points[0], control_points[1], control_points[2]);
+    }
+
+    // |y - X c|^2 = y^T y - c^T X^T X c for the least squares solution c = pinv y (y^T y and the channels summed)
+    double squared_error(double yty, const double red[], const double green[], const double blue[]) const
+    {
+        double fitted = 0.0;
+        for (const double* control_points : {red, green, blue})
+        {
+            for (int i = 0; i < num_params; ++i)
+            {
+                double gram_c = 0.0;
+                for (int j = 0; j < num_params; ++j) { gram_c += gram[i * num_params + j] * control_points[j]; }
+                fitted += control_points[i] * gram_c;
+            }
+        }
+        return std::max(yty - fitted, 0.0);
+    }
+};
+
+//  ---------------------------------------------------------------------------------------------------------------------------
+// | cache of the projection operators per (degree, box width, box height, left/right triangle, clipped box size in pixels)   |
+// | every box of the grid with the same key has its pixels at the same box space coordinates (see box_rasterizer), so the    |
+// | design matrix and its pseudo inverse are the same for all of them: one svd per layout instead of one per triangle        |
+//  ---------------------------------------------------------------------------------------------------------------------------
+class bezier_projection_cache
+{
+    public:
+        struct key
+        {
+            int n;
+            float width;
+            float height;
+            bool left_triangle;
+            int nx;
+            int ny;
+
+            bool operator<(const key& other) const
+            {
+                if (n != other.n) { return n < other.n; }
+                if (width != other.width) { return width < other.width; }
+                if (height != other.height) { return height < other.height; }
+                if (left_triangle != other.left_triangle) { return left_triangle < other.left_triangle; }
+                if (nx != other.nx) { return nx < other.nx; }
+                return ny < other.ny;
+            }
+        };
+
+        // the operator for this key; made from bary_coords (the pixels of a triangle with this layout) if it is not cached yet
+        template <typename bary_container>
+        std::shared_ptr<const bezier_projection> get(const key& layout, const bary_container& bary_coords)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (auto cached = find(layout)) { return cached; }
+            }
+
+            // computed without holding the lock (two threads can both compute the same one, the first one is kept)
+            auto projection = std::make_shared<const bezier_projection>(layout.n, bary_coords);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (auto cached = find(layout)) { return cached; }
+            entries.push_front({layout, projection});
+            index[layout] = entries.begin();
+            while (entries.size() > max_entries)
+            {
+                index.erase(entries.back().layout);
+                entries.pop_back();
+            }
+            return projection;
+        }
+
+    private:
+        struct entry
+        {
+            key layout;
+            std::shared_ptr<const bezier_projection> projection;
+        };
+
+        // a grid has at most 4 layouts per triangle side (inner boxes, last column, last row, top right box), so 8 operators per
+        // degree; the least recently used ones are dropped first, so the layouts of the current grid stay while other sizes come and go
+        static const size_t max_entries = 32;
+        std::mutex mutex;
+        std::list<entry> entries; // most recently used first
+        std::map<key, std::list<entry>::iterator> index;
+
+        // cached operator of the layout (now the most recently used one) or nullptr; the mutex must be held
+        std::shared_ptr<const bezier_projection> find(const key& layout)
+        {
+            auto found = index.find(layout);
+            if (found == index.end()) { return nullptr; }
+            entries.splice(entries.begin(), entries, found->second);
+            return found->second->projection;
+        }
+};
+
+//  ----------------------------------------------------------------------------------------------------------------------------
+// | least squares fit of a degree n bezier triangle via the normal equations (X^T X) c = X^T y, accumulated pixel by pixel    |
+// | X is never stored, so a fit needs O(k^2) memory (k = number of control points, at most 15) on the stack instead of an     |
+// | O(pixels * k) design matrix; the system is solved for r, g and b with one cholesky decomposition                          |
+// | degenerate systems (tiny triangles with fewer pixels than control points) get a small ridge term added to the diagonal    |
+// | weighted least squares (saliency) only scales the basis vector of a pixel before it is added: (X^T W X) c = X^T W y      |
+//  ----------------------------------------------------------------------------------------------------------------------------
+template <int n>
+struct bezier_normal_equations
+{
+    static constexpr int num_params = (n + 1) * (n + 2) / 2;
+    static constexpr double pivot_tolerance = 1e-12; // relative to the largest diagonal element of X^T X
+    static constexpr double ridge = 1e-8; // regularization (relative to the largest diagonal element) when a pivot is too small
+    static constexpr float single_precision_pivot_tolerance = 1e-4f; // float cholesky pivots below this (relative) mean a condition number float cannot handle
+
+    double XtX[num_params][num_params] = {}; // full square (not only one triangle), so the update loop has no branches
+    double Xty[3][num_params] = {};
+    double yty[3] = {0.0, 0.0, 0.0};
+    int count = 0;
+    double weight_sum = 0.0;
+
+    // adds a pixel: barycentric coordinate (s, t, u) in its triangle, color in the range [0, 255] and its weight
+    void add(float s, float t, float u, const float color[3], float weight = 1.0f)
+    {
+        double basis[num_params];
+        double weighted_basis[num_params];
+        bezier_basis<n>(s, t, u, basis);
+        for (int i = 0; i < num_params; ++i) { weighted_basis[i] = weight * basis[i]; }
+        double y[3] = {color[0] / 255.0f, color[1] / 255.0f, color[2] / 255.0f};
+        for (int i = 0; i < num_params; ++i)
+        {
+            for (int j = 0; j < num_params; ++j) { XtX[i][j] += weighted_basis[i] * basis[j]; }
+        }
+        for (int c = 0; c < 3; ++c)
+        {
+            for (int i = 0; i < num_params; ++i) { Xty[c][i] += weighted_basis[i] * y[c]; }
+            yty[c] += weight * y[c] * y[c];
+        }
+        ++count;
+        weight_sum += weight;
+    }
+
+    // normal equations of the same pixels for a bezier triangle of degree m <= n, without going over the pixels again:
+    // X_m = X E^T (see bezier_elevation), so X_m^T W X_m = E (X^T W X) E^T and X_m^T W y = E (X^T W y)
+    template <int m>
+    bezier_normal_equations<m> lower_degree() const
+    {
+        if constexpr (m == n) { return *this; }
+        else
+        {
+            constexpr int num_params_m = bezier_normal_equations<m>::num_params;
+            const auto& E = bezier_elevation_table<m, n>.values;
+            bezier_normal_equations<m> lower;
+            double EXtX[num_params_m][num_params];
+            for (int i = 0; i < num_params_m; ++i)
+            {
+                for (int j = 0; j < num_params; ++j)
+                {
+                    double sum = 0.0;
+                    for (int k = 0; k < num_params; ++k) { sum += E[i][k] * XtX[k][j]; }
+                    EXtX[i][j] = sum;
+                }
+            }
+            for (int i = 0; i < num_params_m; ++i)
+            {
+                for (int j = 0; j < num_params_m; ++j)
+                {
+                    double sum = 0.0;
+                    for (int k = 0; k < num_params; ++k) { sum += EXtX[i][k] * E[j][k]; }
+                    lower.XtX[i][j] = sum;
+                }
+                for (int c = 0; c < 3; ++c)
+                {
+                    double sum = 0.0;
+                    for (int k = 0; k < num_params; ++k) { sum += E[i][k] * Xty[c][k]; }
+                    lower.Xty[c][i] = sum;
+                }
+            }
+            for (int c = 0; c < 3; ++c) { lower.yty[c] = yty[c]; }
+            lower.count = count;
+            lower.weight_sum = weight_sum;
+            return lower;
+        }
+    }
+
+    // control points (control_points[channel][i], range [0, 1]) and (weighted) sum of the squared residuals per channel
+    // returns false when the system had to be regularized (or no pixels were added, then everything is 0)
+    bool solve(double control_points[3][num_params], double chisq[3]) const
+    {
+        double max_diagonal = 0.0;
+        for (int i = 0; i < num_params; ++i) { max_diagonal = std::max(max_diagonal, XtX[i][i]); }
+        double L[num_params][num_params];
+        bool regular = count > 0 && max_diagonal > 0.0 && cholesky(0.0, max_diagonal, L);
+        if (!regular && !(max_diagonal > 0.0 && cholesky(ridge * max_diagonal, 0.0, L)))
+        {
+            std::fill(&control_points[0][0], &control_points[0][0] + 3 * num_params, 0.0);
+            std::fill(chisq, chisq + 3, 0.0);
+            return false;
+        }
+
+        for (int c = 0; c < 3; ++c)
+        {
+            // L z = X^T y, L^T x = z
+            double z[num_params];
+            for (int i = 0; i < num_params; ++i)
+            {
+                double sum = Xty[c][i];
+                for (int k = 0; k < i; ++k) { sum -= L[i][k] * z[k]; }
+                z[i] = sum / L[i][i];
+            }
+            for (int i = num_params - 1; i >= 0; --i)
+            {
+                double sum = z[i];
+                for (int k = i + 1; k < num_params; ++k) { sum -= L[k][i] * control_points[c][k]; }
+                control_points[c][i] = sum / L[i][i];
+            }
+
+            chisq[c] = squared_residual(c, control_points[c]);
+        }
+        return regular;
+    }
+
+    // same as solve, but with the cholesky decomposition and substitutions in float (the sums stay double); when a pivot of the
+    // float decomposition is too small (ill-conditioned triangle) it falls back to solve and returns false
+    bool solve_single_precision(double control_points[3][num_params], double chisq[3]) const
+    {
+        double max_diagonal = 0.0;
+        for (int i = 0; i < num_params; ++i) { max_diagonal = std::max(max_diagonal, XtX[i][i]); }
+        if (count == 0 || !(max_diagonal > 0.0))
+        {
+            solve(control_points, chisq);
+            return true;
+        }
+
+        // scaled by the largest diagonal element, so the float values are around 1
+        float scale = (float)(1.0 / max_diagonal);
+        float L[num_params][num_params];
+        for (int j = 0; j < num_params; ++j)
+        {
+            float pivot = (float)XtX[j][j] * scale;
+            for (int k = 0; k < j; ++k) { pivot -= L[j][k] * L[j][k]; }
+            if (!(pivot > single_precision_pivot_tolerance))
+            {
+                solve(control_points, chisq);
+                return false;
+            }
+            L[j][j] = std::sqrt(pivot);
+            for (int i = j + 1; i < num_params; ++i)
+            {
+                float sum = (float)XtX[i][j] * scale;
+                for (int k = 0; k < j; ++k) { sum -= L[i][k] * L[j][k]; }
+                L[i][j] = sum / L[j][j];
+            }
+        }
+
+        for (int c = 0; c < 3; ++c)
+        {
+            float z[num_params];
+            float x[num_params];
+            for (int i = 0; i < num_params; ++i)
+            {
+                float sum = (float)Xty[c][i] * scale;
+                for (int k = 0; k < i; ++k) { sum -= L[i][k] * z[k]; }
+                z[i] = sum / L[i][i];
+            }
+            for (int i = num_params - 1; i >= 0; --i)
+            {
+                float sum = z[i];
+                for (int k = i + 1; k < num_params; ++k) { sum -= L[k][i] * x[k]; }
+                x[i] = sum / L[i][i];
+            }
+            for (int i = 0; i < num_params; ++i) { control_points[c][i] = x[i]; }
+            chisq[c] = squared_residual(c, control_points[c]);
+        }
+        return true;
+    }
+
+    // |y - X c|^2 = y^T y - 2 c^T X^T y + c^T X^T X c of channel c
+    double squared_residual(int c, const double control_points[num_params]) const
+    {
+        double residual = yty[c];
+        for (int i = 0; i < num_params; ++i)
+        {
+            double XtXc = 0.0;
+            for (int j = 0; j < num_params; ++j) { XtXc += XtX[i][j] * control_points[j]; }
+            residual += control_points[i] * (XtXc - 2.0 * Xty[c][i]);
+        }
+        return std::max(residual, 0.0);
+    }
+
+    // L L^T = X^T X + lambda I (lower triangle of L); false when a pivot is not larger than pivot_tolerance * max_diagonal
+    bool cholesky(double lambda, double max_diagonal, double L[num_params][num_params]) const
+    {
+        for (int j = 0; j < num_params; ++j)
+        {
+            double pivot = XtX[j][j] + lambda;
+            for (int k = 0; k < j; ++k) { pivot -= L[j][k] * L[j][k]; }
+            if (!(pivot > pivot_tolerance * max_diagonal)) { return false; }
+            L[j][j] = std::sqrt(pivot);
+            for (int i = j + 1; i < num_params; ++i)
+            {
+                double sum = XtX[i][j];
+                for (int k = 0; k < j; ++k) { sum -= L[i][k] * L[j][k]; }
+                L[i][j] = sum / L[j][j];
+            }
+        }
+        return true;
+    }
+};
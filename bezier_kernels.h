@@ -0,0 +1,168 @@
+#pragma once
+
+#include "color_kernels.h"
+#include "bezier.h"
+
+//  ------------------------------------------------------------------------------------------------------------------------------
+// | simd kernels that add a span of pixels (one row of a triangle) to the normal equations of a bezier fit, picked at runtime   |
+// | by cpu feature like color_kernels; the scalar kernel adds the pixels one by one (bezier_normal_equations::add)              |
+// | the avx2 kernel evaluates the basis of 8 pixels at once in float and sums X^T W X (upper triangle only), X^T W y, y^T W y   |
+// | and w in float lanes over the span, then adds them to the double sums (a span is at most one row of a box)                 |
+//  ------------------------------------------------------------------------------------------------------------------------------
+struct bezier_span
+{
+    bool left_triangle;
+    float x0; // box space x of the first pixel (see box_rasterizer::x)
+    float dx; // x step per pixel
+    float y;
+    const float* r; // colors in the range [0, 255]
+    const float* g;
+    const float* b;
+    const float* w; // weights, nullptr = unweighted
+    int count;
+};
+template <int n>
+using bezier_span_kernel = void (*)(const bezier_span&, bezier_normal_equations<n>&);
+
+template <int n>
+inline void bezier_add_span_scalar(const bezier_span& span, bezier_normal_equations<n>& equations)
+{
+    for (int i = 0; i < span.count; ++i)
+    {
+        // same barycentric coordinates as convert_to_barycentric
+        float x = span.x0 + i * span.dx;
+        float color[3] = {span.r[i], span.g[i], span.b[i]};
+        float weight = (span.w) ? span.w[i] : 1.0f;
+        if (span.left_triangle) { equations.add(1.0f - span.y - x, x, span.y, color, weight); }
+        else
+        {
+            float s = 1.0f - span.y;
+            float t = 1.0f - x;
+            equations.add(s, t, 1.0f - s - t, color, weight);
+        }
+    }
+}
+
+#ifdef COLOR_KERNELS_X86
+template <int n>
+__attribute__((target("avx2")))
+inline void bezier_add_span_avx2(const bezier_span& span, bezier_normal_equations<n>& equations)
+{
+    constexpr int num_params = bezier_normal_equations<n>::num_params;
+    __m256 acc_XtX[num_params * (num_params + 1) / 2];
+    __m256 acc_Xty[3][num_params];
+    __m256 acc_yty[3];
+    __m256 acc_w = _mm256_setzero_ps();
+    for (__m256& acc : acc_XtX) { acc = _mm256_setzero_ps(); }
+    for (int c = 0; c < 3; ++c)
+    {
+        acc_yty[c] = _mm256_setzero_ps();
+        for (int i = 0; i < num_params; ++i) { acc_Xty[c][i] = _mm256_setzero_ps(); }
+    }
+
+    const __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    const __m256 to_unit = _mm256_set1_ps(1.0f / 255.0f);
+    int p = 0;
+    for (; p + 8 <= span.count; p += 8)
+    {
+        __m256 x = _mm256_add_ps(_mm256_set1_ps(span.x0), _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps((float)p), lanes), _mm256_set1_ps(span.dx)));
+        __m256 y = _mm256_set1_ps(span.y);
+        __m256 s, t, u;
+        if (span.left_triangle)
+        {
+            s = _mm256_sub_ps(_mm256_sub_ps(ones, y), x);
+            t = x;
+            u = y;
+        }
+        else
+        {
+            s = _mm256_sub_ps(ones, y);
+            t = _mm256_sub_ps(ones, x);
+            u = _mm256_sub_ps(_mm256_sub_ps(ones, s), t);
+        }
+
+        __m256 s_pow[n + 1], t_pow[n + 1], u_pow[n + 1];
+        s_pow[0] = t_pow[0] = u_pow[0] = ones;
+        for (int e = 1; e <= n; ++e)
+        {
+            s_pow[e] = _mm256_mul_ps(s_pow[e - 1], s);
+            t_pow[e] = _mm256_mul_ps(t_pow[e - 1], t);
+            u_pow[e] = _mm256_mul_ps(u_pow[e - 1], u);
+        }
+        __m256 w = (span.w) ? _mm256_loadu_ps(span.w + p) : ones;
+        __m256 basis[num_params];
+        __m256 weighted_basis[num_params];
+        int index = 0;
+        for (int i = 0; i <= n; ++i)
+        {
+            for (int j = 0; i+j <= n; ++j)
+            {
+                basis[index] = _mm256_mul_ps(_mm256_set1_ps(bezier_multinomial_table<n>.values[index]), _mm256_mul_ps(s_pow[i], _mm256_mul_ps(t_pow[j], u_pow[n - i - j])));
+                weighted_basis[index] = _mm256_mul_ps(w, basis[index]);
+                ++index;
+            }
+        }
+
+        index = 0;
+        for (int i = 0; i < num_params; ++i)
+        {
+            for (int j = i; j < num_params; ++j)
+            {
+                acc_XtX[index] = _mm256_add_ps(acc_XtX[index], _mm256_mul_ps(weighted_basis[i], basis[j]));
+                ++index;
+            }
+        }
+        const float* colors[3] = {span.r, span.g, span.b};
+        for (int c = 0; c < 3; ++c)
+        {
+            __m256 color = _mm256_mul_ps(_mm256_loadu_ps(colors[c] + p), to_unit);
+            for (int i = 0; i < num_params; ++i) { acc_Xty[c][i] = _mm256_add_ps(acc_Xty[c][i], _mm256_mul_ps(weighted_basis[i], color)); }
+            acc_yty[c] = _mm256_add_ps(acc_yty[c], _mm256_mul_ps(_mm256_mul_ps(w, color), color));
+        }
+        acc_w = _mm256_add_ps(acc_w, w);
+    }
+
+    int index = 0;
+    for (int i = 0; i < num_params; ++i)
+    {
+        for (int j = i; j < num_params; ++j)
+        {
+            double sum = horizontal_sum(acc_XtX[index++]);
+            equations.XtX[i][j] += sum;
+            if (j != i) { equations.XtX[j][i] += sum; }
+        }
+    }
+    for (int c = 0; c < 3; ++c)
+    {
+        for (int i = 0; i < num_params; ++i) { equations.Xty[c][i] += horizontal_sum(acc_Xty[c][i]); }
+        equations.yty[c] += horizontal_sum(acc_yty[c]);
+    }
+    equations.weight_sum += horizontal_sum(acc_w);
+    equations.count += p;
+
+    bezier_span rest = span;
+    rest.x0 = span.x0 + p * span.dx;
+    rest.r += p;
+    rest.g += p;
+    rest.b += p;
+    if (rest.w) { rest.w += p; }
+    rest.count = span.count - p;
+    bezier_add_span_scalar(rest, equations);
+}
+#endif
+
+// picks the widest span kernel the cpu supports (checked once per degree)
+template <int n>
+inline bezier_span_kernel<n> active_bezier_span_kernel()
+{
+    static const bezier_span_kernel<n> kernel = []()
+    {
+#ifdef COLOR_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) { return (bezier_span_kernel<n>)bezier_add_span_avx2<n>; }
+#endif
+        return (bezier_span_kernel<n>)bezier_add_span_scalar<n>;
+    }();
+    return kernel;
+}
@@ -0,0 +1,394 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+
+#include "bezier.h"
+#include "thread_pool.h"
+
+// result of the last global fit (relative residual = |b - A z| / |b| of the normal equations, largest over the channels)
+struct global_fit_report
+{
+    int iterations = 0;
+    double residual = 0.0;
+    double ms = 0.0;
+};
+
+//  ----------------------------------------------------------------------------------------------------------------------------
+// | design matrix X (num_pixels x num_params, row major) and its gram matrix X^T X of one triangle layout (like the           |
+// | projection operators, every box with the same pixel layout has the same X, see bezier_projection_cache)                   |
+//  ----------------------------------------------------------------------------------------------------------------------------
+struct bezier_design
+{
+    int num_params = 0;
+    int num_pixels = 0;
+    std::vector<double> basis;
+    std::vector<double> gram;
+
+    template <typename bary_container>
+    bezier_design(int n, const bary_container& bary_coords)
+    {
+        num_params = (n + 1) * (n + 2) / 2;
+        num_pixels = (int)bary_coords.size();
+        basis.resize((size_t)num_pixels * num_params);
+        gram.assign((size_t)num_params * num_params, 0.0);
+        for (int p = 0; p < num_pixels; ++p)
+        {
+            double* row = &basis[(size_t)p * num_params];
+            bezier_basis(n, bary_coords[p].s, bary_coords[p].t, bary_coords[p].u, row);
+            for (int i = 0; i < num_params; ++i)
+            {
+                for (int j = 0; j < num_params; ++j) { gram[i * num_params + j] += row[i] * row[j]; }
+            }
+        }
+    }
+};
+
+//  ------------------------------------------------------------------------------------------------------------------------------
+// | least squares fit of all triangles of the grid at once with C0 continuous bezier triangles of degree n: the control        |
+// | points of neighbouring triangles on a shared edge (or vertex) are the same unknown, so the unknowns are the nodes of one    |
+// | lattice of (boxes_x * n + 1) x (boxes_y * n + 1) control points (for r, g and b)                                            |
+// | in box (bx, by) control point (i, j, k) (powers of s, t, u) of the left triangle is node (bx * n + j, by * n + k) and of    |
+// | the right triangle node (bx * n + i + k, by * n + j + k)                                                                    |
+// | the normal equations A z = b (A = sum over the triangles of P^T X^T X P, P = the triangle to lattice mapping) are solved    |
+// | with a jacobi preconditioned conjugate gradient; A is never stored: the gram matrices are shared per layout, so memory     |
+// | is O(lattice nodes + triangles * n^2), and a product with A is done per row of boxes, in two passes (even and odd rows) so  |
+// | no two threads add to the same node                                                                                         |
+// | a weighted fit (saliency) has its own X^T W X per triangle instead of the shared gram matrices (triangle_grams)             |
+//  ------------------------------------------------------------------------------------------------------------------------------
+class bezier_lattice_system
+{
+    public:
+        static constexpr double ridge = 1e-10; // regularization relative to the mean diagonal element (nodes without pixels)
+
+        int n = 0;
+        int num_params = 0;
+        int boxes_x = 0;
+        int boxes_y = 0;
+        int nodes_x = 0;
+        int nodes_y = 0;
+        std::vector<const bezier_design*> box_designs; // per box: left and right triangle (2 * box + side)
+        std::vector<double> triangle_rhs; // per triangle: X^T y (num_params x 3)
+        std::vector<double> triangle_yty; // per triangle: y^T y (summed over the channels), only for squared_error
+        std::vector<double> triangle_grams; // per triangle: X^T W X (num_params x num_params), only for weighted fits
+
+        void reset(int degree, int num_boxes_x, int num_boxes_y, bool weighted = false)
+        {
+            n = degree;
+            num_params = (n + 1) * (n + 2) / 2;
+            boxes_x = num_boxes_x;
+            boxes_y = num_boxes_y;
+            nodes_x = boxes_x * n + 1;
+            nodes_y = boxes_y * n + 1;
+            box_designs.assign((size_t)boxes_x * boxes_y * 2, nullptr);
+            triangle_rhs.assign((size_t)boxes_x * boxes_y * 2 * num_params * 3, 0.0);
+            triangle_yty.assign((size_t)boxes_x * boxes_y * 2, 0.0);
+            if (weighted) { triangle_grams.assign((size_t)boxes_x * boxes_y * 2 * num_params * num_params, 0.0); }
+            else { triangle_grams.clear(); }
+
+            // lattice offsets of the control points within a box
+            node_offsets[0].clear();
+            node_offsets[1].clear();
+            for (int i = 0; i <= n; ++i)
+            {
+                for (int j = 0; i+j <= n; ++j)
+                {
+                    int k = n - i - j;
+                    node_offsets[0].push_back(j + k * nodes_x);
+                    node_offsets[1].push_back((i + k) + (j + k) * nodes_x);
+                }
+            }
+        }
+
+        int num_nodes() const { return nodes_x * nodes_y; }
+
+        // X^T (W) X of a triangle (2 * box + side): its own for weighted fits, else the one of its design
+        const double* gram(int triangle) const
+        {
+            if (!triangle_grams.empty()) { return &triangle_grams[(size_t)triangle * num_params * num_params]; }
+            return box_designs[triangle]->gram.data();
+        }
+        double* weighted_gram(int triangle) { return &triangle_grams[(size_t)triangle * num_params * num_params]; }
+
+        // lattice node of control point param of triangle side (0 = left, 1 = right) of a box
+        int node(int box, int side, int param) const
+        {
+            int bx = box % boxes_x;
+            int by = box / boxes_x;
+            return bx * n + by * n * nodes_x + node_offsets[side][param];
+        }
+
+        // |y - X c|^2 = y^T y - 2 c^T X^T y + c^T X^T X c of triangle side of a box with the lattice solution z (channels summed)
+        double squared_error(int box, int side, const std::vector<double>& z) const
+        {
+            if (!box_designs[2 * box + side]) { return 0.0; }
+            const double* triangle_gram = gram(2 * box + side);
+            const double* rhs = &triangle_rhs[(size_t)(2 * box + side) * num_params * 3];
+            double control_points[15 * 3];
+            for (int param = 0; param < num_params; ++param)
+            {
+                for (int c = 0; c < 3; ++c) { control_points[param * 3 + c] = z[(size_t)node(box, side, param) * 3 + c]; }
+            }
+            double error = triangle_yty[2 * box + side];
+            for (int i = 0; i < num_params; ++i)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    double gram_c = 0.0;
+                    for (int j = 0; j < num_params; ++j) { gram_c += triangle_gram[i * num_params + j] * control_points[j * 3 + c]; }
+                    error += control_points[i * 3 + c] * (gram_c - 2.0 * rhs[i * 3 + c]);
+                }
+            }
+            return std::max(error, 0.0);
+        }
+
+        // per triangle least squares solution (each triangle on its own), averaged per node: the start of the conjugate gradient
+        void warm_start(thread_pool& pool, std::vector<double>& z) const
+        {
+            z.assign((size_t)num_nodes() * 3, 0.0);
+            std::vector<double> counts(num_nodes(), 0.0);
+            for_each_box_two_pass(pool, [&](int box)
+            {
+                for (int side = 0; side < 2; ++side)
+                {
+                    double control_points[15 * 3];
+                    if (!box_designs[2 * box + side] || !solve_gram(gram(2 * box + side), &triangle_rhs[(size_t)(2 * box + side) * num_params * 3], control_points)) { continue; }
+                    for (int param = 0; param < num_params; ++param)
+                    {
+                        int m = node(box, side, param);
+                        for (int c = 0; c < 3; ++c) { z[(size_t)m * 3 + c] += control_points[param * 3 + c]; }
+                        counts[m] += 1.0;
+                    }
+                }
+            });
+            pool.parallel_for(0, num_nodes(), [&](int m)
+            {
+                if (counts[m] == 0.0) { return; }
+                for (int c = 0; c < 3; ++c) { z[(size_t)m * 3 + c] /= counts[m]; }
+            });
+        }
+
+        // solves A z = b (z: start value in, solution out; num_nodes x 3, row major) until the relative residual of every
+        // channel is at most tolerance or max_iterations are done
+        global_fit_report solve(thread_pool& pool, std::vector<double>& z, double tolerance, int max_iterations) const
+        {
+            using clock = std::chrono::steady_clock;
+            auto start = clock::now();
+            global_fit_report report;
+            size_t size = (size_t)num_nodes() * 3;
+
+            std::vector<double> b(size, 0.0);
+            std::vector<double> diagonal(num_nodes(), 0.0);
+            for_each_box_two_pass(pool, [&](int box)
+            {
+                for (int side = 0; side < 2; ++side)
+                {
+                    if (!box_designs[2 * box + side]) { continue; }
+                    const double* triangle_gram = gram(2 * box + side);
+                    const double* rhs = &triangle_rhs[(size_t)(2 * box + side) * num_params * 3];
+                    for (int param = 0; param < num_params; ++param)
+                    {
+                        int m = node(box, side, param);
+                        for (int c = 0; c < 3; ++c) { b[(size_t)m * 3 + c] += rhs[param * 3 + c]; }
+                        diagonal[m] += triangle_gram[param * num_params + param];
+                    }
+                }
+            });
+            double mean_diagonal = 0.0;
+            for (double d : diagonal) { mean_diagonal += d; }
+            mean_diagonal /= std::max(num_nodes(), 1);
+            double lambda = ridge * std::max(mean_diagonal, 1e-300);
+
+            std::vector<double> r(size), preconditioned(size), p(size), q(size);
+            multiply(pool, lambda, z, q);
+            pool.parallel_for(0, num_nodes(), [&](int m)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    size_t index = (size_t)m * 3 + c;
+                    r[index] = b[index] - q[index];
+                    preconditioned[index] = r[index] / (diagonal[m] + lambda);
+                    p[index] = preconditioned[index];
+                }
+            });
+
+            double b_norm[3], r_norm[3], rz[3];
+            dot(pool, b, b, b_norm);
+            dot(pool, r, preconditioned, rz);
+            for (int c = 0; c < 3; ++c) { b_norm[c] = std::sqrt(b_norm[c]); }
+            auto relative_residual = [&]()
+            {
+                dot(pool, r, r, r_norm);
+                double residual = 0.0;
+                for (int c = 0; c < 3; ++c)
+                {
+                    if (b_norm[c] > 0.0) { residual = std::max(residual, std::sqrt(r_norm[c]) / b_norm[c]); }
+                }
+                return residual;
+            };
+
+            report.residual = relative_residual();
+            while (report.iterations < max_iterations && report.residual > tolerance)
+            {
+                multiply(pool, lambda, p, q);
+                double pq[3], alpha[3];
+                dot(pool, p, q, pq);
+                for (int c = 0; c < 3; ++c) { alpha[c] = (pq[c] > 0.0) ? rz[c] / pq[c] : 0.0; }
+                pool.parallel_for(0, num_nodes(), [&](int m)
+                {
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        size_t index = (size_t)m * 3 + c;
+                        z[index] += alpha[c] * p[index];
+                        r[index] -= alpha[c] * q[index];
+                        preconditioned[index] = r[index] / (diagonal[m] + lambda);
+                    }
+                });
+                ++report.iterations;
+                report.residual = relative_residual();
+
+                double rz_new[3], beta[3];
+                dot(pool, r, preconditioned, rz_new);
+                for (int c = 0; c < 3; ++c)
+                {
+                    beta[c] = (rz[c] > 0.0) ? rz_new[c] / rz[c] : 0.0;
+                    rz[c] = rz_new[c];
+                }
+                pool.parallel_for(0, num_nodes(), [&](int m)
+                {
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        size_t index = (size_t)m * 3 + c;
+                        p[index] = preconditioned[index] + beta[c] * p[index];
+                    }
+                });
+            }
+
+            report.ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+            return report;
+        }
+
+    private:
+        static const int dot_chunks = 64; // fixed number of partial sums, so the result does not depend on the number of threads
+        std::vector<int> node_offsets[2];
+
+        // func(box) for every box: first the even rows of boxes in parallel, then the odd rows (rows two apart share no nodes)
+        template <typename box_function>
+        void for_each_box_two_pass(thread_pool& pool, box_function&& func) const
+        {
+            for (int parity = 0; parity < 2; ++parity)
+            {
+                pool.parallel_for(0, (boxes_y + 1 - parity) / 2, [&](int row)
+                {
+                    int by = 2 * row + parity;
+                    for (int bx = 0; bx < boxes_x; ++bx) { func(bx + by * boxes_x); }
+                });
+            }
+        }
+
+        // out = (A + lambda I) in
+        void multiply(thread_pool& pool, double lambda, const std::vector<double>& in, std::vector<double>& out) const
+        {
+            pool.parallel_for(0, num_nodes(), [&](int m)
+            {
+                for (int c = 0; c < 3; ++c) { out[(size_t)m * 3 + c] = lambda * in[(size_t)m * 3 + c]; }
+            });
+            for_each_box_two_pass(pool, [&](int box)
+            {
+                for (int side = 0; side < 2; ++side)
+                {
+                    if (!box_designs[2 * box + side]) { continue; }
+                    const double* triangle_gram = gram(2 * box + side);
+                    int nodes[15];
+                    double local[15 * 3];
+                    for (int param = 0; param < num_params; ++param)
+                    {
+                        nodes[param] = node(box, side, param);
+                        for (int c = 0; c < 3; ++c) { local[param * 3 + c] = in[(size_t)nodes[param] * 3 + c]; }
+                    }
+                    for (int i = 0; i < num_params; ++i)
+                    {
+                        double sum[3] = {0.0, 0.0, 0.0};
+                        const double* gram_row = &triangle_gram[i * num_params];
+                        for (int j = 0; j < num_params; ++j)
+                        {
+                            for (int c = 0; c < 3; ++c) { sum[c] += gram_row[j] * local[j * 3 + c]; }
+                        }
+                        for (int c = 0; c < 3; ++c) { out[(size_t)nodes[i] * 3 + c] += sum[c]; }
+                    }
+                }
+            });
+        }
+
+        // per channel dot product of two num_nodes x 3 vectors
+        void dot(thread_pool& pool, const std::vector<double>& a, const std::vector<double>& b, double result[3]) const
+        {
+            double partial[dot_chunks][3];
+            int count = num_nodes();
+            pool.parallel_for(0, dot_chunks, [&](int chunk)
+            {
+                int begin = (int)((long long)count * chunk / dot_chunks);
+                int end = (int)((long long)count * (chunk + 1) / dot_chunks);
+                double sum[3] = {0.0, 0.0, 0.0};
+                for (int m = begin; m < end; ++m)
+                {
+                    for (int c = 0; c < 3; ++c) { sum[c] += a[(size_t)m * 3 + c] * b[(size_t)m * 3 + c]; }
+                }
+                for (int c = 0; c < 3; ++c) { partial[chunk][c] = sum[c]; }
+            });
+            for (int c = 0; c < 3; ++c)
+            {
+                result[c] = 0.0;
+                for (int chunk = 0; chunk < dot_chunks; ++chunk) { result[c] += partial[chunk][c]; }
+            }
+        }
+
+        // control_points (num_params x 3) = gram^-1 rhs with a cholesky decomposition (small ridge term when it is singular)
+        bool solve_gram(const double* gram, const double* rhs, double control_points[]) const
+        {
+            double max_diagonal = 0.0;
+            for (int i = 0; i < num_params; ++i) { max_diagonal = std::max(max_diagonal, gram[i * num_params + i]); }
+            if (max_diagonal <= 0.0) { return false; }
+
+            double L[15][15];
+            for (double lambda : {0.0, 1e-8 * max_diagonal})
+            {
+                bool regular = true;
+                for (int j = 0; j < num_params && regular; ++j)
+                {
+                    double pivot = gram[j * num_params + j] + lambda;
+                    for (int k = 0; k < j; ++k) { pivot -= L[j][k] * L[j][k]; }
+                    if (!(pivot > ((lambda == 0.0) ? 1e-12 * max_diagonal : 0.0))) { regular = false; break; }
+                    L[j][j] = std::sqrt(pivot);
+                    for (int i = j + 1; i < num_params; ++i)
+                    {
+                        double sum = gram[i * num_params + j];
+                        for (int k = 0; k < j; ++k) { sum -= L[i][k] * L[j][k]; }
+                        L[i][j] = sum / L[j][j];
+                    }
+                }
+                if (!regular) { continue; }
+
+                for (int c = 0; c < 3; ++c)
+                {
+                    double y[15];
+                    for (int i = 0; i < num_params; ++i)
+                    {
+                        double sum = rhs[i * 3 + c];
+                        for (int k = 0; k < i; ++k) { sum -= L[i][k] * y[k]; }
+                        y[i] = sum / L[i][i];
+                    }
+                    for (int i = num_params - 1; i >= 0; --i)
+                    {
+                        double sum = y[i];
+                        for (int k = i + 1; k < num_params; ++k) { sum -= L[k][i] * control_points[k * 3 + c]; }
+                        control_points[i * 3 + c] = sum / L[i][i];
+                    }
+                }
+                return true;
+            }
+            return false;
+        }
+};
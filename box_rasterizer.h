@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+//  --------------------------------------------------------------------------------------------------------------------------------
+// | for row j of a box (nx pixels per row): the last pixel i for which x + y <= 1 holds (-1 if none) and the first pixel i for     |
+// | which x + y >= 1 holds (nx if none); (x, y) is the middle of pixel (i, j) in box space coordinates ((0,0) bottom left, (1,1)   |
+// | top right), computed with the same float arithmetic as the rest of the coloring code, so pixels on the diagonal are in both    |
+//  --------------------------------------------------------------------------------------------------------------------------------
+inline int last_pixel_left(int j, int nx, float width_triangle_pixels, float height_triangle_pixels)
+{
+    float y = ((float)j + 0.5) / height_triangle_pixels;
+    auto in_left = [&](int i) { float x = ((float)i + 0.5) / width_triangle_pixels; return x + y <= 1.0f; };
+    int i = std::min(std::max((int)std::floor(width_triangle_pixels * (1.0 - y) - 0.5), -1), nx - 1);
+    while (i + 1 < nx && in_left(i + 1)) { ++i; }
+    while (i >= 0 && !in_left(i)) { --i; }
+    return i;
+}
+inline int first_pixel_right(int j, int nx, float width_triangle_pixels, float height_triangle_pixels)
+{
+    float y = ((float)j + 0.5) / height_triangle_pixels;
+    auto in_right = [&](int i) { float x = ((float)i + 0.5) / width_triangle_pixels; return x + y >= 1.0f; };
+    int i = std::min(std::max((int)std::ceil(width_triangle_pixels * (1.0 - y) - 0.5), 0), nx);
+    while (i > 0 && in_right(i - 1)) { --i; }
+    while (i < nx && !in_right(i)) { ++i; }
+    return i;
+}
+
+//  ---------------------------------------------------------------------------------------------------------------------------------
+// | scanline walker over the pixels of one grid box                                                                                |
+// | pixel (i, j) of the box is image pixel (x0 + i, y0 + j); the box has ceil(width) x ceil(height) pixels (clipped to the image)   |
+// | for_each_span visits every row once and gives the exact pixel spans [i_begin, i_end) of the left (bottom left) triangle and     |
+// | the right (top right) triangle to one consumer, so no pixel is visited to be rejected and no per pixel triangle test is needed  |
+//  ---------------------------------------------------------------------------------------------------------------------------------
+struct box_rasterizer
+{
+    int x0;
+    int y0;
+    int nx;
+    int ny;
+    float width;
+    float height;
+
+    box_rasterizer(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, int img_cols, int img_rows)
+    {
+        x0 = (int)std::floor(bottom_left_x_pixels);
+        y0 = (int)std::floor(bottom_left_y_pixels);
+        nx = std::max(std::min((int)std::ceil(width_triangle_pixels), img_cols - x0), 0);
+        ny = std::max(std::min((int)std::ceil(height_triangle_pixels), img_rows - y0), 0);
+        width = width_triangle_pixels;
+        height = height_triangle_pixels;
+    }
+
+    // middle of pixel (i, j) in box space coordinates
+    float x(int i) const { return ((float)i + 0.5) / width; }
+    float y(int j) const { return ((float)j + 0.5) / height; }
+
+    // span_func(j, i_begin, i_end, left_triangle); per row first the left span then the right span (empty spans are skipped)
+    template <typename span_function>
+    void for_each_span(span_function&& span_func) const
+    {
+        for (int j = 0; j < ny; ++j)
+        {
+            int left_end = last_pixel_left(j, nx, width, height) + 1;
+            int right_begin = first_pixel_right(j, nx, width, height);
+            if (left_end > 0) { span_func(j, 0, left_end, true); }
+            if (right_begin < nx) { span_func(j, right_begin, nx, false); }
+        }
+    }
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define COLOR_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+//  ------------------------------------------------------------------------------------------------------------------------------
+// | simd kernels for the color reductions, compiled with target attributes and picked at runtime by cpu feature (so the default |
+// | build flags still run on any cpu); the scalar kernels are the fallback                                                      |
+// | to_planar:   converts a span of BGR8 pixels to the float planes of planar_color_image (R, G, B, w*R, w*G, w*B, w with        |
+// |              w = saliency + saliency_bias); the x86 kernels deinterleave with byte shuffles, widen to float and multiply by  |
+// |              the weight 4 (sse4.1) or 8 (avx2) pixels at a time                                                              |
+// | planar_sums: sums[5] += {sum r, sum g, sum b, sum w, sum r R + g G + b B} over a span of float planes (r, g, b weighted or  |
+// |              not, R, G, B unweighted, so the last sum is sum w (R^2 + G^2 + B^2)); the span is summed in float (at most one  |
+// |              image row) and added to the double sums                                                                         |
+//  ------------------------------------------------------------------------------------------------------------------------------
+struct planar_span
+{
+    float* r;
+    float* g;
+    float* b;
+    float* r_weighted;
+    float* g_weighted;
+    float* b_weighted;
+    float* w;
+};
+typedef void (*to_planar_kernel)(const unsigned char* bgr, const float* saliency, int count, float saliency_bias, const planar_span& out);
+typedef void (*planar_sums_kernel)(const float* r, const float* g, const float* b, const float* w, const float* r_unweighted, const float* g_unweighted, const float* b_unweighted, int count, double sums[5]);
+
+struct color_kernels
+{
+    const char* name;
+    to_planar_kernel to_planar;
+    planar_sums_kernel planar_sums;
+};
+
+inline void to_planar_scalar(const unsigned char* bgr, const float* saliency, int count, float saliency_bias, const planar_span& out)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        float w = saliency[i] + saliency_bias;
+        float r = bgr[3 * i + 2];
+        float g = bgr[3 * i + 1];
+        float b = bgr[3 * i + 0];
+        out.r[i] = r;
+        out.g[i] = g;
+        out.b[i] = b;
+        out.r_weighted[i] = r * w;
+        out.g_weighted[i] = g * w;
+        out.b_weighted[i] = b * w;
+        out.w[i] = w;
+    }
+}
+inline void planar_sums_scalar(const float* r, const float* g, const float* b, const float* w, const float* r_unweighted, const float* g_unweighted, const float* b_unweighted, int count, double sums[5])
+{
+    float r_sum = 0.0f, g_sum = 0.0f, b_sum = 0.0f, w_sum = 0.0f, squared_sum = 0.0f;
+    for (int i = 0; i < count; ++i)
+    {
+        r_sum += r[i];
+        g_sum += g[i];
+        b_sum += b[i];
+        w_sum += w[i];
+        squared_sum += r[i] * r_unweighted[i] + g[i] * g_unweighted[i] + b[i] * b_unweighted[i];
+    }
+    sums[0] += r_sum;
+    sums[1] += g_sum;
+    sums[2] += b_sum;
+    sums[3] += w_sum;
+    sums[4] += squared_sum;
+}
+
+#ifdef COLOR_KERNELS_X86
+// byte positions of channel c of pixels 0..3 in a 16 byte load (pixel 0 at byte 0) and of pixels 4..7 when the load starts at byte 8
+#define COLOR_KERNELS_MASK_LO(c) _mm_setr_epi8(c, c + 3, c + 6, c + 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)
+#define COLOR_KERNELS_MASK_HI(c) _mm_setr_epi8(-1, -1, -1, -1, c + 4, c + 7, c + 10, c + 13, -1, -1, -1, -1, -1, -1, -1, -1)
+
+__attribute__((target("sse4.1")))
+inline float horizontal_sum(__m128 v)
+{
+    __m128 shuf = _mm_movehdup_ps(v);
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+__attribute__((target("avx2")))
+inline float horizontal_sum(__m256 v)
+{
+    return horizontal_sum(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+__attribute__((target("sse4.1")))
+inline void to_planar_sse41(const unsigned char* bgr, const float* saliency, int count, float saliency_bias, const planar_span& out)
+{
+    const __m128i mask_b = COLOR_KERNELS_MASK_LO(0);
+    const __m128i mask_g = COLOR_KERNELS_MASK_LO(1);
+    const __m128i mask_r = COLOR_KERNELS_MASK_LO(2);
+    const __m128 bias = _mm_set1_ps(saliency_bias);
+
+    int i = 0;
+    // a 16 byte load for 4 pixels (12 bytes) must stay inside the span -> at least 6 pixels left
+    for (; i + 6 <= count; i += 4)
+    {
+        __m128i px = _mm_loadu_si128((const __m128i*)(bgr + 3 * i));
+        __m128 b = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_shuffle_epi8(px, mask_b)));
+        __m128 g = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_shuffle_epi8(px, mask_g)));
+        __m128 r = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_shuffle_epi8(px, mask_r)));
+        __m128 w = _mm_add_ps(_mm_loadu_ps(saliency + i), bias);
+        _mm_storeu_ps(out.r + i, r);
+        _mm_storeu_ps(out.g + i, g);
+        _mm_storeu_ps(out.b + i, b);
+        _mm_storeu_ps(out.r_weighted + i, _mm_mul_ps(r, w));
+        _mm_storeu_ps(out.g_weighted + i, _mm_mul_ps(g, w));
+        _mm_storeu_ps(out.b_weighted + i, _mm_mul_ps(b, w));
+        _mm_storeu_ps(out.w + i, w);
+    }
+    planar_span rest = {out.r + i, out.g + i, out.b + i, out.r_weighted + i, out.g_weighted + i, out.b_weighted + i, out.w + i};
+    to_planar_scalar(bgr + 3 * i, saliency + i, count - i, saliency_bias, rest);
+}
+__attribute__((target("sse4.1")))
+inline void planar_sums_sse41(const float* r, const float* g, const float* b, const float* w, const float* r_unweighted, const float* g_unweighted, const float* b_unweighted, int count, double sums[5])
+{
+    __m128 acc_r = _mm_setzero_ps(), acc_g = _mm_setzero_ps(), acc_b = _mm_setzero_ps(), acc_w = _mm_setzero_ps(), acc_squared = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 r4 = _mm_loadu_ps(r + i);
+        __m128 g4 = _mm_loadu_ps(g + i);
+        __m128 b4 = _mm_loadu_ps(b + i);
+        acc_r = _mm_add_ps(acc_r, r4);
+        acc_g = _mm_add_ps(acc_g, g4);
+        acc_b = _mm_add_ps(acc_b, b4);
+        acc_w = _mm_add_ps(acc_w, _mm_loadu_ps(w + i));
+        acc_squared = _mm_add_ps(acc_squared, _mm_mul_ps(r4, _mm_loadu_ps(r_unweighted + i)));
+        acc_squared = _mm_add_ps(acc_squared, _mm_mul_ps(g4, _mm_loadu_ps(g_unweighted + i)));
+        acc_squared = _mm_add_ps(acc_squared, _mm_mul_ps(b4, _mm_loadu_ps(b_unweighted + i)));
+    }
+    sums[0] += horizontal_sum(acc_r);
+    sums[1] += horizontal_sum(acc_g);
+    sums[2] += horizontal_sum(acc_b);
+    sums[3] += horizontal_sum(acc_w);
+    sums[4] += horizontal_sum(acc_squared);
+    planar_sums_scalar(r + i, g + i, b + i, w + i, r_unweighted + i, g_unweighted + i, b_unweighted + i, count - i, sums);
+}
+
+__attribute__((target("avx2")))
+inline void to_planar_avx2(const unsigned char* bgr, const float* saliency, int count, float saliency_bias, const planar_span& out)
+{
+    const __m128i mask_b_lo = COLOR_KERNELS_MASK_LO(0), mask_b_hi = COLOR_KERNELS_MASK_HI(0);
+    const __m128i mask_g_lo = COLOR_KERNELS_MASK_LO(1), mask_g_hi = COLOR_KERNELS_MASK_HI(1);
+    const __m128i mask_r_lo = COLOR_KERNELS_MASK_LO(2), mask_r_hi = COLOR_KERNELS_MASK_HI(2);
+    const __m256 bias = _mm256_set1_ps(saliency_bias);
+
+    int i = 0;
+    // 8 pixels = 24 bytes, read as bytes [0, 16) and [8, 24)
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(bgr + 3 * i));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(bgr + 3 * i + 8));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(lo, mask_b_lo), _mm_shuffle_epi8(hi, mask_b_hi))));
+        __m256 g = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(lo, mask_g_lo), _mm_shuffle_epi8(hi, mask_g_hi))));
+        __m256 r = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(lo, mask_r_lo), _mm_shuffle_epi8(hi, mask_r_hi))));
+        __m256 w = _mm256_add_ps(_mm256_loadu_ps(saliency + i), bias);
+        _mm256_storeu_ps(out.r + i, r);
+        _mm256_storeu_ps(out.g + i, g);
+        _mm256_storeu_ps(out.b + i, b);
+        _mm256_storeu_ps(out.r_weighted + i, _mm256_mul_ps(r, w));
+        _mm256_storeu_ps(out.g_weighted + i, _mm256_mul_ps(g, w));
+        _mm256_storeu_ps(out.b_weighted + i, _mm256_mul_ps(b, w));
+        _mm256_storeu_ps(out.w + i, w);
+    }
+    planar_span rest = {out.r + i, out.g + i, out.b + i, out.r_weighted + i, out.g_weighted + i, out.b_weighted + i, out.w + i};
+    to_planar_scalar(bgr + 3 * i, saliency + i, count - i, saliency_bias, rest);
+}
+__attribute__((target("avx2")))
+inline void planar_sums_avx2(const float* r, const float* g, const float* b, const float* w, const float* r_unweighted, const float* g_unweighted, const float* b_unweighted, int count, double sums[5])
+{
+    __m256 acc_r = _mm256_setzero_ps(), acc_g = _mm256_setzero_ps(), acc_b = _mm256_setzero_ps(), acc_w = _mm256_setzero_ps(), acc_squared = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 r8 = _mm256_loadu_ps(r + i);
+        __m256 g8 = _mm256_loadu_ps(g + i);
+        __m256 b8 = _mm256_loadu_ps(b + i);
+        acc_r = _mm256_add_ps(acc_r, r8);
+        acc_g = _mm256_add_ps(acc_g, g8);
+        acc_b = _mm256_add_ps(acc_b, b8);
+        acc_w = _mm256_add_ps(acc_w, _mm256_loadu_ps(w + i));
+        acc_squared = _mm256_add_ps(acc_squared, _mm256_mul_ps(r8, _mm256_loadu_ps(r_unweighted + i)));
+        acc_squared = _mm256_add_ps(acc_squared, _mm256_mul_ps(g8, _mm256_loadu_ps(g_unweighted + i)));
+        acc_squared = _mm256_add_ps(acc_squared, _mm256_mul_ps(b8, _mm256_loadu_ps(b_unweighted + i)));
+    }
+    sums[0] += horizontal_sum(acc_r);
+    sums[1] += horizontal_sum(acc_g);
+    sums[2] += horizontal_sum(acc_b);
+    sums[3] += horizontal_sum(acc_w);
+    sums[4] += horizontal_sum(acc_squared);
+    planar_sums_scalar(r + i, g + i, b + i, w + i, r_unweighted + i, g_unweighted + i, b_unweighted + i, count - i, sums);
+}
+#endif
+
+// picks the widest kernels the cpu supports (checked once)
+inline const color_kernels& active_color_kernels()
+{
+    static const color_kernels kernels = []()
+    {
+#ifdef COLOR_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) { return color_kernels{"avx2", to_planar_avx2, planar_sums_avx2}; }
+        if (__builtin_cpu_supports("sse4.1")) { return color_kernels{"sse4.1", to_planar_sse41, planar_sums_sse41}; }
+#endif
+        return color_kernels{"scalar", to_planar_scalar, planar_sums_scalar};
+    }();
+    return kernels;
+}
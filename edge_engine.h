@@ -0,0 +1,129 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+//  ------------------------------------------------------------------------------------------------------------------------------
+// | canny edge detection split in the part that only depends on the image and the part that depends on the thresholds          |
+// | set_image filters the image (bilateral, median, grayscale), computes the sobel gradients (aperture 3, L1 magnitude) and    |
+// | does the non-maximum suppression like cv::Canny; edges then only does the double threshold hysteresis for the thresholds,  |
+// | starting at the pixels above the high threshold and following the 8-connected pixels above the low threshold, so moving    |
+// | the threshold slider only costs time proportional to the number of edge pixels (plus clearing the output image)            |
+//  ------------------------------------------------------------------------------------------------------------------------------
+class edge_engine
+{
+    public:
+        void set_image(const cv::Mat& img)
+        {
+            // can still be improved a lot
+            cv::Mat img_filtered;
+            cv::bilateralFilter(img, img_filtered, 9, 75, 75);
+            cv::medianBlur(img_filtered, img_filtered, 5);
+            cv::cvtColor(img_filtered, gray, cv::COLOR_BGR2GRAY);
+
+            cv::Mat dx, dy;
+            cv::Sobel(gray, dx, CV_16S, 1, 0, 3, 1, 0, cv::BORDER_REPLICATE);
+            cv::Sobel(gray, dy, CV_16S, 0, 1, 3, 1, 0, cv::BORDER_REPLICATE);
+
+            // magnitudes with a border of zeros, so the neighbours of every pixel can be read without bounds checks
+            rows = gray.rows;
+            cols = gray.cols;
+            stride = cols + 2;
+            std::vector<int> magnitude(stride * (rows + 2), 0);
+            for (int y = 0; y < rows; ++y)
+            {
+                const short* dx_row = dx.ptr<short>(y);
+                const short* dy_row = dy.ptr<short>(y);
+                int* magnitude_row = magnitude.data() + (y + 1) * stride + 1;
+                for (int x = 0; x < cols; ++x) { magnitude_row[x] = std::abs(dx_row[x]) + std::abs(dy_row[x]); }
+            }
+
+            // non-maximum suppression along the gradient direction rounded to 0, 45, 90 or 135 degrees (same comparisons as cv::Canny)
+            const int tan22 = (int)(0.4142135623730950488016887242097 * (1 << 15) + 0.5);
+            suppressed.assign(stride * (rows + 2), 0);
+            candidates.clear();
+            for (int y = 0; y < rows; ++y)
+            {
+                const short* dx_row = dx.ptr<short>(y);
+                const short* dy_row = dy.ptr<short>(y);
+                for (int x = 0; x < cols; ++x)
+                {
+                    int p = (y + 1) * stride + x + 1;
+                    int m = magnitude[p];
+                    if (m == 0) { continue; }
+
+                    int xs = std::abs(dx_row[x]);
+                    int ys = std::abs(dy_row[x]) << 15;
+                    int tan22x = xs * tan22;
+                    bool maximum;
+                    if (ys < tan22x) { maximum = m > magnitude[p - 1] && m >= magnitude[p + 1]; }
+                    else if (ys > tan22x + (xs << 16)) { maximum = m > magnitude[p - stride] && m >= magnitude[p + stride]; }
+                    else
+                    {
+                        int s = ((dx_row[x] ^ dy_row[x]) < 0) ? -1 : 1;
+                        maximum = m > magnitude[p - stride - s] && m > magnitude[p + stride + s];
+                    }
+                    if (maximum)
+                    {
+                        suppressed[p] = m;
+                        candidates.push_back(p);
+                    }
+                }
+            }
+            // strongest first, so the seeds of every high threshold are a prefix
+            std::sort(candidates.begin(), candidates.end(), [&](int a, int b) { return suppressed[a] > suppressed[b]; });
+            marked.assign(stride * (rows + 2), 0);
+        }
+
+        // edge map (CV_8U, 255 = edge) of the last image for the thresholds (like cv::Canny(gray, edges, low, high, 3))
+        void edges(int low_threshold, int high_threshold, cv::Mat& edges_out)
+        {
+            // the border of zeros only stops the hysteresis for thresholds >= 0
+            low_threshold = std::max(low_threshold, 0);
+            high_threshold = std::max(high_threshold, 0);
+            edges_out = cv::Mat::zeros(rows, cols, CV_8U);
+            stack.clear();
+            for (int p : candidates)
+            {
+                if (suppressed[p] <= high_threshold) { break; }
+                if (!marked[p])
+                {
+                    marked[p] = 1;
+                    stack.push_back(p);
+                }
+            }
+            // stack also holds every marked pixel, the ones below index are done
+            for (size_t index = 0; index < stack.size(); ++index)
+            {
+                int p = stack[index];
+                const int neighbours[8] = {p - stride - 1, p - stride, p - stride + 1, p - 1, p + 1, p + stride - 1, p + stride, p + stride + 1};
+                for (int q : neighbours)
+                {
+                    if (!marked[q] && suppressed[q] > low_threshold)
+                    {
+                        marked[q] = 1;
+                        stack.push_back(q);
+                    }
+                }
+            }
+            for (int p : stack)
+            {
+                marked[p] = 0;
+                edges_out.ptr<unsigned char>(p / stride - 1)[p % stride - 1] = 255;
+            }
+        }
+
+    private:
+        cv::Mat gray;
+        int rows = 0;
+        int cols = 0;
+        int stride = 0; // cols + 2 (border of one pixel)
+        std::vector<int> suppressed; // gradient magnitude where it is a local maximum, 0 elsewhere (with border)
+        std::vector<int> candidates; // indices of the local maxima, sorted on decreasing magnitude
+        std::vector<unsigned char> marked; // pixels in the stack of the current hysteresis (all 0 between calls)
+        std::vector<int> stack;
+};
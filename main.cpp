@@ -12,6 +12,7 @@
 #include <filesystem>
 #include <string>
 #include <set>
+#include <map>
 
 // image processing libraries (edge detection / saliency detection)
 #include <opencv2/core.hpp>
@@ -21,12 +22,24 @@
 #include <opencv2/highgui.hpp>
 
 // data fitting libraries
-#include <gsl/gsl_fit.h>
 #include <gsl/gsl_multifit.h>
+#include <gsl/gsl_cblas.h>
+#include <gsl/gsl_errno.h>
 
 #include <glad/gl.h>
 #include <GLFW/glfw3.h>
 #include "shader.h" // load and link shaders from files
+#include "box_rasterizer.h" // scanline walker over the pixels of the two triangles of a grid box
+#include "planar_image.h" // cached planar float copy of the image and saliency map
+#include "triangle_sums.h" // prefix sums for constant color triangles
+#include "thread_pool.h" // worker threads for the coloring methods
+#include "triangle_sampler.h" // optional stratified subsampling of the pixels of a triangle
+#include "bezier.h" // bezier triangle basis and cached least squares projection operators
+#include "bezier_lattice.h" // global C0 continuous bezier fit with shared control points
+#include "bezier_kernels.h" // simd kernels for the single precision bezier fit
+#include "pipeline_stage.h" // cache keys and dirty flags of the recalculation stages
+#include "saliency_cache.h" // lru cache of the saliency maps per image and saliency method
+#include "edge_engine.h" // canny edge detection with the gradients kept between threshold changes
 
 // computer graphics function/matrices to pass to the shaders (orthogonal projection matrix)
 #include <glm/glm.hpp>
@@ -40,8 +53,13 @@
 const int max_triangles_per_side = 52;
 const int num_floats_per_buffer = max_triangles_per_side * max_triangles_per_side * 2 * 3; // # triangles * 3 (r, g, b)
 const float saliency_bias = 0.1; // small bias to the saliency so no pixel will be "completely" ignored in saliency mode
-enum saliency_method { fine_grained, spectral_residual };
-const int num_uniform_buffers = 15;
+const int num_uniform_buffers = 15; // 15 control points of the biquartic interpolation (opengl 3.3 only guarantees 12 uniform blocks per shader stage)
+const float adaptive_degree_marker = -1e30f; // far below any control point: the last uniform buffer of a lower degree adaptive triangle holds its degree
+static_assert(num_uniform_buffers == (bezier_max_degree + 1) * (bezier_max_degree + 2) / 2, "one uniform buffer per control point of the highest degree");
+const size_t bezier_batch_cache_bytes = 256 * 1024; // size of the color matrix of a tile of the batched bezier fit (about the L2 cache size)
+const size_t saliency_cache_bytes = 512 * 1024 * 1024; // memory for cached saliency maps (about 10 maps of a 12 megapixel image)
+const double global_fit_tolerance = 1e-6; // relative residual at which the conjugate gradient of the global bezier fit stops
+const int global_fit_max_iterations = 1000;
 
 const char* image_path = "input_images";
 const char* image_save_path = "output_image.png";
@@ -61,7 +79,11 @@ struct update_coloring_info
     int num_triangles_y;
     cv::Mat img;
     cv::Mat saliency_map;
+    planar_color_image planar; // img and saliency_map as float planes (rebuild when either changes)
     bool use_saliency;
+    sampling_settings sampling;
+    bezier_solver_type bezier_solver;
+    float* triangle_errors = nullptr; // optional (nullptr = off): weighted squared error of every fitted triangle (r + g + b, colors [0, 1])
 };
 struct pixel_info
 {
@@ -71,6 +93,50 @@ struct pixel_info
     float x;
     float y;
 };
+// running sums for the (weighted) average color of a set of pixels, gathered in a single pass over the image
+struct color_accumulator
+{
+    double color_sum[3] = {0.0, 0.0, 0.0}; // r, g, b
+    double weight_sum = 0.0;
+    double squared_sum = 0.0; // w (r^2 + g^2 + b^2), for the squared error of a color
+
+    // adds pixel i of a row (the planes are already multiplied with the weight)
+    void add(const planar_row& row, int i)
+    {
+        color_sum[0] += row.r[i];
+        color_sum[1] += row.g[i];
+        color_sum[2] += row.b[i];
+        weight_sum += row.w[i];
+        squared_sum += row.r[i] * row.r_unweighted[i] + row.g[i] * row.g_unweighted[i] + row.b[i] * row.b_unweighted[i];
+    }
+    // adds the pixels [i_begin, i_begin + count) of a row (see color_kernels.h)
+    void add_span(const planar_row& row, int i_begin, int count)
+    {
+        if (count <= 0) { return; }
+        double sums[5] = {0.0, 0.0, 0.0, 0.0, 0.0};
+        active_color_kernels().planar_sums(row.r + i_begin, row.g + i_begin, row.b + i_begin, row.w + i_begin, row.r_unweighted + i_begin, row.g_unweighted + i_begin, row.b_unweighted + i_begin, count, sums);
+        color_sum[0] += sums[0];
+        color_sum[1] += sums[1];
+        color_sum[2] += sums[2];
+        weight_sum += sums[3];
+        squared_sum += sums[4];
+    }
+    // sum w |y - color|^2 = sum w y^2 - 2 color . sum w y + |color|^2 sum w (r + g + b, color in the range [0, 1])
+    double squared_error(const float color[3]) const
+    {
+        if (!(weight_sum > 0.0)) { return 0.0; }
+        double error = squared_sum / (255.0 * 255.0);
+        for (int c = 0; c < 3; ++c) { error += color[c] * (color[c] * weight_sum - 2.0 * color_sum[c] / 255.0); }
+        return std::max(error, 0.0);
+    }
+    // average color in the range [0, 1] (NaN when no pixels were added)
+    void average(float average[3]) const
+    {
+        average[0] = (float)(color_sum[0] / (weight_sum * 255.0));
+        average[1] = (float)(color_sum[1] / (weight_sum * 255.0));
+        average[2] = (float)(color_sum[2] / (weight_sum * 255.0));
+    }
+};
 struct barycentric_coordinates
 {
     float s;
@@ -78,17 +144,249 @@ struct barycentric_coordinates
     float u;
 };
 
+//  ----------------------------------------------------------------------------------------------------------------------
+// | reusable buffers for fitting the two triangles of a box; sized once for the largest box and reset (not freed) per box |
+// | the gsl buffers are allocated for max_pixels x max_params and each fit uses a view of the size it needs               |
+// | one instance per thread (see thread_scratch), so the steady state of the fitting loop does no heap allocations        |
+//  ----------------------------------------------------------------------------------------------------------------------
+struct box_scratch
+{
+    std::vector<pixel_info> pixels[2]; // left triangle, right triangle
+    std::vector<barycentric_coordinates> bary_coords[2];
+    // batched projection fit (see update_general_interpolation_batched): stacked colors per triangle side and the resulting control points
+    std::vector<double> batch_colors[2];
+    std::vector<double> batch_control_points;
+    std::vector<double> batch_yty; // y^T y per box and triangle side of the tile (for the squared errors)
+
+    size_t max_pixels = 0;
+    size_t max_params = 0;
+    gsl_matrix* X = nullptr;
+    gsl_vector* y = nullptr;
+    gsl_vector* c = nullptr;
+    gsl_multifit_linear_workspace* work = nullptr;
+
+    box_scratch() = default;
+    box_scratch(const box_scratch&) = delete;
+    box_scratch& operator=(const box_scratch&) = delete;
+    ~box_scratch() { free_gsl(); }
+
+    // grows the buffers if needed (only happens when a bigger box or a higher degree than before is used)
+    void reserve(size_t num_pixels, size_t num_params)
+    {
+        for (int i = 0; i < 2; ++i)
+        {
+            pixels[i].reserve(num_pixels);
+            bary_coords[i].reserve(num_pixels);
+        }
+        if (num_pixels <= max_pixels && num_params <= max_params) { return; }
+
+        free_gsl();
+        max_pixels = std::max(num_pixels, max_pixels);
+        max_params = std::max(num_params, max_params);
+        X = gsl_matrix_alloc(max_pixels, max_params);
+        y = gsl_vector_alloc(max_pixels);
+        c = gsl_vector_alloc(max_params);
+        work = gsl_multifit_linear_alloc(max_pixels, max_params);
+    }
+    void free_gsl()
+    {
+        if (!X) { return; }
+        gsl_multifit_linear_free(work);
+        gsl_matrix_free(X);
+        gsl_vector_free(y);
+        gsl_vector_free(c);
+        X = nullptr;
+    }
+};
+box_scratch& thread_scratch()
+{
+    static thread_local box_scratch scratch;
+    return scratch;
+}
+// worker threads of the coloring methods; every method runs its rows of grid boxes in parallel (see thread_pool.h)
+thread_pool& coloring_pool()
+{
+    static thread_pool pool;
+    return pool;
+}
+// projection operators of the bezier fits, shared by all threads and kept between recalculations (see bezier.h)
+bezier_projection_cache& bezier_projections()
+{
+    static bezier_projection_cache projections;
+    return projections;
+}
+// saliency maps of the images and saliency modes that were used in this session (see saliency_cache.h)
+saliency_cache& saliency_maps()
+{
+    static saliency_cache maps(saliency_cache_bytes);
+    return maps;
+}
+
+//  ---------------------------------------------------------------------------------------------------------------------
+// | pixel tests in box space coordinates (see box_rasterizer), concrete types so the pixel loops get inlined            |
+// | left triangle = bottom left half of the box, right triangle = top right half of the box                             |
+// | the split tests select one side (left_side = below/left of the curve) of a curve within the given triangle          |
+// | (whole_box_test when the pixels are already restricted to one triangle, like the spans of box_rasterizer)           |
+//  ---------------------------------------------------------------------------------------------------------------------
+struct whole_box_test
+{
+    bool operator()(float x, float y) const { return true; }
+};
+struct left_triangle_test
+{
+    bool operator()(float x, float y) const { return x + y <= 1.0f; }
+};
+struct right_triangle_test
+{
+    bool operator()(float x, float y) const { return x + y >= 1.0f; }
+};
+template <typename triangle_test, bool left_side>
+struct linear_split_test
+{
+    triangle_test which_triangle;
+    double c0;
+    double c1;
+    bool operator()(float x, float y) const { return which_triangle(x, y) && ((left_side) ? c0 + c1 * x >= y : c0 + c1 * x <= y); }
+};
+template <typename triangle_test, bool left_side>
+struct vertical_split_test
+{
+    triangle_test which_triangle;
+    float x_line;
+    bool operator()(float x, float y) const { return which_triangle(x, y) && ((left_side) ? x <= x_line : x >= x_line); }
+};
+template <typename triangle_test, bool left_side>
+struct quadratic_split_test
+{
+    triangle_test which_triangle;
+    float c0;
+    float c1;
+    float c2;
+    bool operator()(float x, float y) const { return which_triangle(x, y) && ((left_side) ? c0 + (c1 * x) + (c2 * x * x) >= y : c0 + (c1 * x) + (c2 * x * x) <= y); }
+};
+
+// curve that splits a triangle in 2 constant color areas (result of the line/quadratic fit on the edge pixels of the triangle)
+enum split_type { no_split, linear_split, vertical_split, quadratic_split };
+struct triangle_split
+{
+    split_type type = no_split;
+    // y = c0 + c1 * x + c2 * x * x (linear_split: c2 = 0) or x = c0 (vertical_split)
+    double c0 = 0.0;
+    double c1 = 0.0;
+    double c2 = 0.0;
+};
+// running sums of the edge points of a triangle for the least squares line y = c0 + c1 * x, updated during the edge scan
+struct line_moments
+{
+    int count = 0;
+    double x_sum = 0.0;
+    double y_sum = 0.0;
+    double xy_sum = 0.0;
+    double xx_sum = 0.0;
+    // all points have the same x (vertical line, no y = c0 + c1 * x fit) when x_min == x_max
+    double x_min = INFINITY;
+    double x_max = -INFINITY;
+
+    void add(double x, double y)
+    {
+        ++count;
+        x_sum += x;
+        y_sum += y;
+        xy_sum += x * y;
+        xx_sum += x * x;
+        x_min = std::min(x_min, x);
+        x_max = std::max(x_max, x);
+    }
+};
+// running sums of the edge points of a triangle for the least squares quadratic y = c0 + c1 * x + c2 * x * x, updated during the edge scan
+// x is shifted to the middle of the box (x - 0.5), which keeps the 3x3 normal equations better conditioned
+struct quadratic_moments
+{
+    int count = 0;
+    double xk_sum[5] = {0.0, 0.0, 0.0, 0.0, 0.0}; // sum x^k (k = 0..4)
+    double xky_sum[3] = {0.0, 0.0, 0.0}; // sum x^k * y (k = 0..2)
+
+    void add(double x, double y)
+    {
+        ++count;
+        x -= 0.5;
+        double xk = 1.0;
+        for (int k = 0; k < 5; ++k)
+        {
+            xk_sum[k] += xk;
+            if (k < 3) { xky_sum[k] += xk * y; }
+            xk *= x;
+        }
+    }
+
+    // c0, c1, c2 of the fit (unshifted x); cholesky of the 3x3 normal equations, with a small ridge term when they are
+    // (close to) singular, e.g. all points on 1 or 2 vertical lines (then it is close to the minimum norm solution)
+    // returns false when there is no finite solution
+    bool solve(double c[3]) const
+    {
+        double A[3][3];
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j) { A[i][j] = xk_sum[i + j]; }
+        }
+        double max_diagonal = std::max(A[0][0], std::max(A[1][1], A[2][2]));
+        double L[3][3];
+        if (!cholesky(A, 0.0, 1e-12 * max_diagonal, L) && !cholesky(A, 1e-9 * max_diagonal, 0.0, L)) { return false; }
+
+        // L z = b, L^T a = z (a = coefficients in the shifted x)
+        double z[3], a[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            double sum = xky_sum[i];
+            for (int k = 0; k < i; ++k) { sum -= L[i][k] * z[k]; }
+            z[i] = sum / L[i][i];
+        }
+        for (int i = 2; i >= 0; --i)
+        {
+            double sum = z[i];
+            for (int k = i + 1; k < 3; ++k) { sum -= L[k][i] * a[k]; }
+            a[i] = sum / L[i][i];
+        }
+
+        // a0 + a1 * (x - 0.5) + a2 * (x - 0.5)^2
+        c[0] = a[0] - 0.5 * a[1] + 0.25 * a[2];
+        c[1] = a[1] - a[2];
+        c[2] = a[2];
+        return std::isfinite(c[0]) && std::isfinite(c[1]) && std::isfinite(c[2]);
+    }
+
+    // L L^T = A + lambda I; false when a pivot is not larger than min_pivot
+    static bool cholesky(const double A[3][3], double lambda, double min_pivot, double L[3][3])
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            double pivot = A[j][j] + lambda;
+            for (int k = 0; k < j; ++k) { pivot -= L[j][k] * L[j][k]; }
+            if (!(pivot > min_pivot)) { return false; }
+            L[j][j] = std::sqrt(pivot);
+            for (int i = j + 1; i < 3; ++i)
+            {
+                double sum = A[i][j];
+                for (int k = 0; k < j; ++k) { sum -= L[i][k] * L[j][k]; }
+                L[i][j] = sum / L[j][j];
+            }
+        }
+        return true;
+    }
+};
+
 //  -------------------------------------------------------
 // | function pointers for function that are at the bottom |
 //  -------------------------------------------------------
 // startup functions
 static void glfw_error_callback(int error, const char* description);
+static void gsl_error_callback(const char* reason, const char* file, int line, int gsl_errno);
 void load_picture(cv::Mat& img, const std::string file_name);
 GLFWwindow* glfw_setup();
 
 // intermediate function for some of the coloring algorithms
 void update_saliency_map(const cv::Mat& img, cv::Mat& saliency_map, int saliency_mode);
-void get_edges(const cv::Mat& img, cv::Mat& edges, int low_threshold);
+double fit_triangle_normal_equations(int n, const std::vector<pixel_info>& pixels, const std::vector<barycentric_coordinates>& bary_coords, bool use_saliency, float** triangle_colors, int triangle_colors_base, double& squared_error);
 
 void update_vertex_buffer(int num_triangles_x, int num_triangles_y, float vertices[], const float vertex_colors[]);
 void update_index_buffer(int num_triangles_x, int num_triangles_y, unsigned int indices[]);
@@ -96,10 +394,15 @@ void update_index_buffer(int num_triangles_x, int num_triangles_y, unsigned int
 // coloring methods
 void update_vertex_colors(const update_coloring_info& coloring_info, float vertices[], float vertex_colors[]);
 void update_triangle_center_colors(const update_coloring_info& coloring_info, const float vertices[], float triangle_colors1[]);
-void update_constant_colors(const update_coloring_info& coloring_info, const float vertices[], float triangle_colors1[]);
+void update_constant_colors(const update_coloring_info& coloring_info, const triangle_sum_table& triangle_sums, const float vertices[], float triangle_colors1[]);
+void update_sampled_constant_colors(const update_coloring_info& coloring_info, const float vertices[], float triangle_colors1[], sampling_report& report);
 void update_linear_split_constant_color(const update_coloring_info& coloring_info, const cv::Mat& edges, const float vertices[], int num_edge_detection_points, float* triangle_colors[]);
 void update_quadratic_split_constant_color(const update_coloring_info& coloring_info, const cv::Mat& edges, const float vertices[], int num_edge_detection_points, float* triangle_colors[]);
-void update_general_interpolation(int n, const update_coloring_info& coloring_info, const float vertices[], float** triangle_colors);
+void update_general_interpolation(int n, const update_coloring_info& coloring_info, const float vertices[], float** triangle_colors, sampling_report& report, single_precision_report& precision_report);
+void update_adaptive_interpolation(const update_coloring_info& coloring_info, const float vertices[], float max_error, float** triangle_colors, int degree_counts[]);
+void update_global_interpolation(int n, const update_coloring_info& coloring_info, const float vertices[], float** triangle_colors, global_fit_report& report);
+int adaptive_degree(float** triangle_colors, int triangle);
+void mix_error_map(int mode, int num_triangles_x, int num_triangles_y, const float triangle_errors[], float error_scale, const float vertex_colors[], float** triangle_colors);
 
 int main(int argc, const char** argv)
 {
@@ -109,6 +412,8 @@ int main(int argc, const char** argv)
     update_coloring_info coloring_info;
     cv::Mat img_temp;
     cv::Mat edges;
+    edge_engine edge_detector;
+    triangle_sum_table triangle_sums;
 
     auto dir_path = std::filesystem::absolute(image_path);
     std::vector<std::string> images;
@@ -127,13 +432,22 @@ int main(int argc, const char** argv)
         return 1;
     }
 
-    load_picture(img_temp, images[0]);
-    cv::flip(img_temp, coloring_info.img, 0); // so the coordinate systems orientation for both opengl and opencv are alligned (opencv values range [0,1], opencv [0, img height/width])
-
     GLFWwindow* window = glfw_setup();
     if (!window) { return 1; };
+    // one uniform block per control point of the biquartic interpolation, more than opengl 3.3 guarantees (12)
+    GLint max_fragment_uniform_blocks = 0;
+    glGetIntegerv(GL_MAX_FRAGMENT_UNIFORM_BLOCKS, &max_fragment_uniform_blocks);
+    if (max_fragment_uniform_blocks < num_uniform_buffers)
+    {
+        std::cout << "the fragment shader needs " << num_uniform_buffers << " uniform blocks, this gpu supports " << max_fragment_uniform_blocks << std::endl;
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return 1;
+    }
+    // the default gsl error handler aborts the program (from within a worker thread of the coloring methods)
+    gsl_set_error_handler(gsl_error_callback);
 
-    Shader shader (vert_shader_path, geom_shader_path, frag_shader_path);
+    Shader shader (vert_shader_path, geom_shader_path, frag_shader_path, bezier_glsl_tables()); // the fragment shader gets the bezier coefficient tables
     
     //  -------------------------
     // | generate opengl buffers |
@@ -178,16 +492,30 @@ int main(int argc, const char** argv)
     int low_threshold = 59;
     bool show_edge_map = false;
     bool save_image = false;
-    std::chrono::duration<double, std::milli> ms_taken;
-
-    // for checking if recalculation is needed
-    int old_chosen_image = -1;
-    int old_mode = -1;
-    int old_saliency_mode = -1;
-    int old_num_triangles_dimensions[2] = { 0, 0};
-    bool old_use_saliency = false;
-    int old_num_edge_detection_points = -1;
-    int old_low_threshold = -1;
+    int max_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+    int num_threads = max_threads;
+    sampling_settings sampling;
+    sampling_report sampling_results;
+    int bezier_solver = bezier_solver_projection;
+    float adaptive_max_error = 0.03f;
+    int adaptive_degree_counts[bezier_max_degree + 1] = {0};
+    bool global_fit = false;
+    single_precision_report single_precision_results;
+    bool show_error_map = false;
+    std::vector<float> triangle_errors(max_triangles_per_side * max_triangles_per_side * 2, NAN); // NaN = no estimate
+    int worst_triangle = -1;
+    global_fit_report global_fit_results;
+
+    // stages of the recalculation (see pipeline_stage.h), the keys are the settings and the versions of the stages they read
+    pipeline_stage<int> decode_stage; // image
+    pipeline_stage<unsigned long long> flip_stage; // decode
+    pipeline_stage<unsigned long long, int> saliency_stage; // flip, saliency mode
+    pipeline_stage<unsigned long long> gradients_stage; // flip: filtered grayscale, gradients and non-maximum suppression (see edge_engine.h)
+    pipeline_stage<unsigned long long, int> edges_stage; // gradients, threshold: hysteresis (both only run for the split modes or the edge map)
+    pipeline_stage<unsigned long long, unsigned long long> gather_stage; // flip, saliency: planar image
+    pipeline_stage<unsigned long long, bool> sums_stage; // gather, use saliency: prefix sums (only run for the constant (avg) mode)
+    pipeline_stage<unsigned long long, unsigned long long, unsigned long long, int, int, int, bool, int, int, sampling_settings, int, float, bool, bool> fit_stage;
+    pipeline_stage<unsigned long long> upload_stage; // fit
 
     // make an array for the vertex and triangle colors that can later be loaded into an opengl buffer
     float vertex_colors[(max_triangles_per_side + 1) * (max_triangles_per_side + 1) * 3];
@@ -249,15 +577,83 @@ int main(int argc, const char** argv)
                                         "biquadratic interpolation (opt)\0"
                                         "bicubic interpolation (opt)\0"
                                         "biquartic interpolation (opt)\0"
+                                        "adaptive interpolation (opt)\0"
                                         "\0");
 
             ImGui::SliderInt("min # of edge detection points needed (step)", &num_edge_detection_points, 2, 20);
             ImGui::SliderInt("theshold edge detection", &low_threshold, 0, 160);
             ImGui::Checkbox("show edge map (close window by pressing any key)", &show_edge_map);
 
+            ImGui::SliderInt("# threads", &num_threads, 1, max_threads);
+            ImGui::SliderFloat("adaptive interpolation max error (rms)", &adaptive_max_error, 0.0f, 0.2f, "%.3f");
+            ImGui::Combo("bezier solver", &bezier_solver, "svd per triangle\0cached projection\0normal equations\0batched projection (blas)\0normal equations (float simd)\0\0");
+            bezier_solver_type used_solver = effective_bezier_solver((bezier_solver_type)bezier_solver, use_saliency, sampling.enabled);
+            if (used_solver != bezier_solver)
+            {
+                // the svd and projection solvers can not weight the pixels (use saliency), the projections need all pixels of a box
+                bool weighted = used_solver == bezier_solver_normal_equations;
+                ImGui::TextDisabled("(%s: the per triangle fits use the %s solver)", (weighted) ? "use saliency" : "sample pixels", (weighted) ? "normal equations" : "svd per triangle");
+            }
+            ImGui::Checkbox("global fit (shared control points, interpolation (opt) modes)", &global_fit);
+            ImGui::Checkbox("show error map (squared error per triangle)", &show_error_map);
+
+            // only use a subset of the pixels of every triangle for the average and bezier fits
+            ImGui::Checkbox("sample pixels (avg + bezier fits)", &sampling.enabled);
+            if (sampling.enabled)
+            {
+                ImGui::SliderInt("samples per triangle", &sampling.target_samples, 16, 4096);
+                ImGui::Checkbox("more samples until error bound", &sampling.use_error_bound);
+                if (sampling.use_error_bound) { ImGui::SliderFloat("error bound (95% confidence)", &sampling.error_bound, 0.001f, 0.1f, "%.3f"); }
+            }
+
             ImGui::Checkbox("save image", &save_image);
 
-            ImGui::Text("Computation took: %.3f ms", ms_taken.count());
+            ImGui::Text("Computation took: %.3f ms", fit_stage.ms);
+            if (ImGui::TreeNode("pipeline stages (last run)"))
+            {
+                ImGui::Text("decode: %.3f ms, %llu runs", decode_stage.ms, decode_stage.version);
+                ImGui::Text("flip: %.3f ms, %llu runs", flip_stage.ms, flip_stage.version);
+                ImGui::Text("saliency: %.3f ms, %llu runs (cache: %d hits, %d misses, %zu maps, %.1f MB)", saliency_stage.ms, saliency_stage.version, saliency_maps().hits(), saliency_maps().misses(), saliency_maps().size(), saliency_maps().bytes() / (1024.0 * 1024.0));
+                ImGui::Text("edge gradients: %.3f ms, %llu runs", gradients_stage.ms, gradients_stage.version);
+                ImGui::Text("edges: %.3f ms, %llu runs", edges_stage.ms, edges_stage.version);
+                ImGui::Text("gather: %.3f ms, %llu runs", gather_stage.ms, gather_stage.version);
+                ImGui::Text("prefix sums: %.3f ms, %llu runs", sums_stage.ms, sums_stage.version);
+                ImGui::Text("fit: %.3f ms, %llu runs", fit_stage.ms, fit_stage.version);
+                ImGui::Text("upload: %.3f ms, %llu runs", upload_stage.ms, upload_stage.version);
+                ImGui::TreePop();
+            }
+            if (sampling.enabled && sampling_results.num_pixels > 0)
+            {
+                ImGui::Text("Sampled %lld of %lld pixels, error (95%%): mean %.4f max %.4f", sampling_results.num_samples, sampling_results.num_pixels, sampling_results.mean_error, sampling_results.max_error);
+            }
+            ImGui::Text("Color sum kernels: %s", active_color_kernels().name);
+            if (mode == 9)
+            {
+                ImGui::Text("Triangles per degree: 0: %d, 1: %d, 2: %d, 3: %d, 4: %d", adaptive_degree_counts[0], adaptive_degree_counts[1], adaptive_degree_counts[2], adaptive_degree_counts[3], adaptive_degree_counts[4]);
+            }
+            if (bezier_solver == bezier_solver_single_precision && mode >= 5 && mode <= 8 && single_precision_results.num_fits > 0)
+            {
+                ImGui::Text("Float fits: %d of %d triangles fell back to double", single_precision_results.num_fallbacks, single_precision_results.num_fits);
+            }
+            if (show_error_map && worst_triangle >= 0)
+            {
+                ImGui::Text("Largest squared error: triangle %d (%.4f)", worst_triangle, triangle_errors[worst_triangle]);
+            }
+            if (global_fit && mode >= 5 && mode <= 8)
+            {
+                ImGui::Text("Global fit: %d iterations, relative residual %.2e, solver %.3f ms", global_fit_results.iterations, global_fit_results.residual, global_fit_results.ms);
+            }
+            // load balance of the split methods (the last time one of them was computed)
+            if (ImGui::TreeNode("worker utilization (split methods)"))
+            {
+                const std::vector<worker_stats>& stats = coloring_pool().get_stats();
+                for (int i = 0; i < (int)stats.size(); ++i)
+                {
+                    double utilization = (stats[i].wall_ms > 0.0) ? 100.0 * stats[i].busy_ms / stats[i].wall_ms : 0.0;
+                    ImGui::Text("worker %d: %.1f%% busy, %d boxes, %d steals", i, utilization, stats[i].tasks, stats[i].steals);
+                }
+                ImGui::TreePop();
+            }
             // ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
             ImGui::End();
         }
@@ -299,44 +695,51 @@ int main(int argc, const char** argv)
         unsigned int indices[num_vertices];
         update_index_buffer(num_triangles_dimensions[0], num_triangles_dimensions[1], indices);
 
-        //  ----------------------------------------------------------------------------------------------
-        // | update triangle coloring variables (only when something changed and recalculation is needed) |
-        //  ----------------------------------------------------------------------------------------------
-        if (!(
-              chosen_image == old_chosen_image &&
-              mode == old_mode && 
-              num_triangles_dimensions[0] == old_num_triangles_dimensions[0] && 
-              num_triangles_dimensions[1] == old_num_triangles_dimensions[1] && 
-              use_saliency == old_use_saliency && 
-              old_saliency_mode == saliency_mode &&
-              old_num_edge_detection_points == num_edge_detection_points &&
-              old_low_threshold == low_threshold))
+        //  --------------------------------------------------------------------------------------------------------------------
+        // | update triangle coloring variables: decode -> flip -> saliency -> gradients -> edges -> gather -> fit -> upload     |
+        // | every stage only reruns when its key changed (see pipeline_stage.h), so e.g. a new mode or grid size only refits   |
+        //  --------------------------------------------------------------------------------------------------------------------
+        decode_stage.run({chosen_image}, [&]() { load_picture(img_temp, images[chosen_image]); });
+        // so the coordinate systems orientation for both opengl and opencv are alligned (opencv values range [0,1], opencv [0, img height/width])
+        flip_stage.run({decode_stage.version}, [&]() { cv::flip(img_temp, coloring_info.img, 0); });
+        saliency_stage.run({flip_stage.version, saliency_mode}, [&]() { update_saliency_map(coloring_info.img, coloring_info.saliency_map, saliency_mode); });
+        bool uses_edges = mode == 3 || mode == 4;
+        if (uses_edges || show_edge_map)
         {
-            old_chosen_image = chosen_image;
-            old_mode = mode;
-            old_num_triangles_dimensions[0] = num_triangles_dimensions[0];
-            old_num_triangles_dimensions[1] = num_triangles_dimensions[1];
-            old_use_saliency = use_saliency;
-            old_saliency_mode = saliency_mode;
-            old_num_edge_detection_points = num_edge_detection_points;
-            old_low_threshold = low_threshold;
-
-            load_picture(img_temp, images[chosen_image]);
-            cv::flip(img_temp, coloring_info.img, 0); // so the coordinate systems orientation for both opengl and opencv are alligned (opencv values range [0,1], opencv [0, img height/width])
-            update_saliency_map(coloring_info.img, coloring_info.saliency_map, saliency_mode);
-            get_edges(coloring_info.img, edges, low_threshold);
+            // only the hysteresis reruns when the threshold changes
+            gradients_stage.run({flip_stage.version}, [&]() { edge_detector.set_image(coloring_info.img); });
+            edges_stage.run({gradients_stage.version, low_threshold}, [&]() { edge_detector.edges(low_threshold, low_threshold * 3, edges); });
+        }
+        gather_stage.run({flip_stage.version, saliency_stage.version}, [&]() { coloring_info.planar.build(coloring_info.img, coloring_info.saliency_map, saliency_bias); });
+        if (mode == 0 && !sampling.enabled) { sums_stage.run({gather_stage.version, use_saliency}, [&]() { triangle_sums.build(coloring_info.planar, use_saliency); }); }
 
+        fit_stage.run({gather_stage.version, (uses_edges) ? edges_stage.version : 0, (mode == 0 && !sampling.enabled) ? sums_stage.version : 0,
+                       mode, num_triangles_dimensions[0], num_triangles_dimensions[1], use_saliency, num_edge_detection_points, num_threads,
+                       sampling, effective_bezier_solver((bezier_solver_type)bezier_solver, use_saliency, sampling.enabled), adaptive_max_error, global_fit, show_error_map}, [&]()
+        {
             coloring_info.num_triangles_x = num_triangles_dimensions[0];
             coloring_info.num_triangles_y = num_triangles_dimensions[1];
             coloring_info.use_saliency = use_saliency;
+            coloring_info.sampling = sampling;
+            coloring_info.bezier_solver = (bezier_solver_type)bezier_solver;
+            std::fill(triangle_errors.begin(), triangle_errors.end(), NAN);
+            coloring_info.triangle_errors = (show_error_map) ? triangle_errors.data() : nullptr;
+            // only the fits of this run fill the reports (global fit, mode 9 and the unsampled modes leave them empty)
+            sampling_results = sampling_report();
+            single_precision_results = single_precision_report();
 
-            auto t1 = std::chrono::high_resolution_clock::now(); // used to measure the time taken for a coloring method to complete
+            coloring_pool().resize(num_threads);
 
             // compute the variables for the given coloring mode, so that it can be send to the shader to output an image
             switch (mode)
             {
                 case 0:
-                    update_constant_colors(coloring_info, vertices, triangle_colors[0]);
+                    if (sampling.enabled)
+                    {
+                        update_sampled_constant_colors(coloring_info, vertices, triangle_colors[0], sampling_results);
+                        break;
+                    }
+                    update_constant_colors(coloring_info, triangle_sums, vertices, triangle_colors[0]);
                     break;
                 case 1:
                     update_triangle_center_colors(coloring_info, vertices, triangle_colors[0]);
@@ -351,21 +754,38 @@ int main(int argc, const char** argv)
                     update_quadratic_split_constant_color(coloring_info, edges, vertices, num_edge_detection_points, triangle_colors);
                     break;
                 case 5:
-                    update_general_interpolation(1, coloring_info, vertices, triangle_colors);
+                    if (global_fit) { update_global_interpolation(1, coloring_info, vertices, triangle_colors, global_fit_results); break; }
+                    update_general_interpolation(1, coloring_info, vertices, triangle_colors, sampling_results, single_precision_results);
                     break;
                 case 6:
-                    update_general_interpolation(2, coloring_info, vertices, triangle_colors);
+                    if (global_fit) { update_global_interpolation(2, coloring_info, vertices, triangle_colors, global_fit_results); break; }
+                    update_general_interpolation(2, coloring_info, vertices, triangle_colors, sampling_results, single_precision_results);
                     break;
                 case 7:
-                    update_general_interpolation(3, coloring_info, vertices, triangle_colors);
+                    if (global_fit) { update_global_interpolation(3, coloring_info, vertices, triangle_colors, global_fit_results); break; }
+                    update_general_interpolation(3, coloring_info, vertices, triangle_colors, sampling_results, single_precision_results);
                     break;
                 case 8:
-                    update_general_interpolation(4, coloring_info, vertices, triangle_colors);
+                    if (global_fit) { update_global_interpolation(4, coloring_info, vertices, triangle_colors, global_fit_results); break; }
+                    update_general_interpolation(4, coloring_info, vertices, triangle_colors, sampling_results, single_precision_results);
+                    break;
+                case 9:
+                    update_adaptive_interpolation(coloring_info, vertices, adaptive_max_error, triangle_colors, adaptive_degree_counts);
                     break;
             }
-            auto t2 = std::chrono::high_resolution_clock::now();
-            ms_taken = t2 - t1;
-        }
+
+            worst_triangle = -1;
+            for (int triangle = 0; triangle < num_triangles_dimensions[0] * num_triangles_dimensions[1] * 2; ++triangle)
+            {
+                float error = triangle_errors[triangle];
+                if (!std::isnan(error) && (worst_triangle < 0 || error > triangle_errors[worst_triangle])) { worst_triangle = triangle; }
+            }
+            if (show_error_map)
+            {
+                float error_scale = (worst_triangle >= 0 && triangle_errors[worst_triangle] > 0.0f) ? 1.0f / triangle_errors[worst_triangle] : 0.0f;
+                mix_error_map(mode, num_triangles_dimensions[0], num_triangles_dimensions[1], triangle_errors.data(), error_scale, vertex_colors, triangle_colors);
+            }
+        });
 
         //  --------------------------------------------------------------------------------------------------------
         // | shows (and saves) the saliency map when the checkbox is selected in the imgui window                   |
@@ -373,8 +793,9 @@ int main(int argc, const char** argv)
         //  --------------------------------------------------------------------------------------------------------
         if (show_saliency_map)
         {
+            // the map that is used for the fits, flipped back to the orientation of the image
             cv::Mat temp_saliency_map;
-            update_saliency_map(img_temp, temp_saliency_map, saliency_mode);
+            cv::flip(coloring_info.saliency_map, temp_saliency_map, 0);
             cv::namedWindow("saliency map", cv::WINDOW_NORMAL);
             cv::resizeWindow("saliency map", 600, 600);
             cv::imshow("saliency map", temp_saliency_map);
@@ -385,12 +806,13 @@ int main(int argc, const char** argv)
         }
         if (show_edge_map)
         {
-            cv::Mat edges;
-            get_edges(img_temp, edges, low_threshold);
+            // the map that is used for the fits, flipped back to the orientation of the image
+            cv::Mat temp_edges;
+            cv::flip(edges, temp_edges, 0);
             cv::namedWindow("edge map", cv::WINDOW_NORMAL);
             cv::resizeWindow("edge map", 600, 600);
-            cv::imshow("edge map", edges);
-            cv::imwrite(edge_map_save_path, edges);
+            cv::imshow("edge map", temp_edges);
+            cv::imwrite(edge_map_save_path, temp_edges);
             cv::waitKey(0);
             cv::destroyAllWindows();
             show_edge_map = false;
@@ -400,13 +822,16 @@ int main(int argc, const char** argv)
         // | put all the buffers on the gpu  |
         //  ---------------------------------
 
-        // binding all the uniform buffers
-        for (int i = 0; i < num_uniform_buffers; ++i)
+        // binding all the uniform buffers (only after a fit changed them)
+        upload_stage.run({fit_stage.version}, [&]()
         {
-            glBindBuffer(GL_UNIFORM_BUFFER, variables[i]);
-            glBufferSubData(GL_UNIFORM_BUFFER, 0, 4 * num_floats_per_buffer, triangle_colors[i]);
-            glBindBuffer(GL_UNIFORM_BUFFER, 0);
-        }
+            for (int i = 0; i < num_uniform_buffers; ++i)
+            {
+                glBindBuffer(GL_UNIFORM_BUFFER, variables[i]);
+                glBufferSubData(GL_UNIFORM_BUFFER, 0, 4 * num_floats_per_buffer, triangle_colors[i]);
+                glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            }
+        });
 
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
@@ -419,6 +844,7 @@ int main(int argc, const char** argv)
 
         // glUniform4f(glGetUniformLocation(shader.ID, "weight"), weightx, weighty, weightz, weightw);
         glUniform1i(glGetUniformLocation(shader.ID, "mode"), mode);
+        glUniform1i(glGetUniformLocation(shader.ID, "show_error_map"), show_error_map);
         glm::mat4 proj = glm::ortho(0.0f, 1.0f, 0.0f, 1.0f, -10.0f, 10.0f); // have a coordinate system (0, 0) bottom left and (1, 1) top right
         glUniformMatrix4fv(glGetUniformLocation(shader.ID, "projection"), 1, GL_FALSE, glm::value_ptr(proj));
 
@@ -455,109 +881,260 @@ int main(int argc, const char** argv)
 }
 
 //  ---------------------------------------------------------------------------------------------------------------------------------------------------
-// | returns a list of pixels (pixel_info struct) that lie in the given box coordinates and satisfy the given count_pixel function                     |
-// | count_pixel funciton; takes in the pixel (x, y) in box space coordinates and returns true if it should save it and false when it can be discarded |
+// | collects the pixels (pixel_info struct) of both triangles in the given box coordinates in one pass over the box (see box_rasterizer)              |
+// | triangle_1 gets the left (bottom left) triangle and triangle_2 the right (top right) triangle; pixels on the diagonal end up in both             |
 // | box space coordinates (0,0) bottom left bounding box (1, 1) top right bounding box (box has 2 triangles in it which are rendered by the shader)   |
 //  ---------------------------------------------------------------------------------------------------------------------------------------------------
-void get_pixels_in_triangle(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, const cv::Mat& img, const cv::Mat& saliency_map, const std::function<bool (float x, float y)> count_pixel, std::vector<pixel_info>& triangle_info)
+void get_pixels_in_box(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, const planar_color_image& planar, std::vector<pixel_info>& triangle_1, std::vector<pixel_info>& triangle_2)
 {
-    for (int j = 0; j < height_triangle_pixels; j++)
+    box_rasterizer box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, planar.cols, planar.rows);
+    box.for_each_span([&](int j, int i_begin, int i_end, bool left_triangle)
     {
-        for (int i = 0; i < width_triangle_pixels; i++)
+        const float* red_row = planar.plane_row(planar_color_image::red, box.y0 + j) + box.x0;
+        const float* green_row = planar.plane_row(planar_color_image::green, box.y0 + j) + box.x0;
+        const float* blue_row = planar.plane_row(planar_color_image::blue, box.y0 + j) + box.x0;
+        const float* weight_row = planar.plane_row(planar_color_image::weight, box.y0 + j) + box.x0;
+        std::vector<pixel_info>& triangle_info = (left_triangle) ? triangle_1 : triangle_2;
+        float y = box.y(j);
+        for (int i = i_begin; i < i_end; ++i)
         {
-            int x2 = std::floor(i + bottom_left_x_pixels);
-            int y2 = std::floor(j + bottom_left_y_pixels);
-            cv::Vec3b val = img.at<cv::Vec3b>(y2, x2);
-            float saliency_val = saliency_map.at<float>(y2, x2);
-            saliency_val += saliency_bias;
-
-            // get the (x, y) in the middle of the pixel in box coordinates (where (0,0) is in the bottom left at (1, 1) at the top right of the bounding box)
-            float x = ((float)i + 0.5) / (float)width_triangle_pixels;
-            float y = ((float)j + 0.5) / (float)height_triangle_pixels;
-            if (count_pixel(x, y))
-            {
-                pixel_info p_info;
-                p_info.color[0] = val[2];
-                p_info.color[1] = val[1];
-                p_info.color[2] = val[0];
-                p_info.saliency_value = saliency_val;
-                p_info.x = x;
-                p_info.y = y;
-                triangle_info.push_back(p_info);
-            }
+            pixel_info p_info;
+            p_info.color[0] = red_row[i];
+            p_info.color[1] = green_row[i];
+            p_info.color[2] = blue_row[i];
+            p_info.saliency_value = weight_row[i];
+            p_info.x = box.x(i);
+            p_info.y = y;
+            triangle_info.push_back(p_info);
         }
+    });
+}
+// same as get_pixels_in_box, but only for the stratified subset of the pixels of the box (about samples_per_triangle per triangle, see box_sampler)
+void sample_pixels_in_box(const box_rasterizer& box, const planar_color_image& planar, int samples_per_triangle, std::vector<pixel_info>& triangle_1, std::vector<pixel_info>& triangle_2)
+{
+    box_sampler sampler(box, samples_per_triangle);
+    sampler.for_each_sample([&](int i, int j, bool in_left, bool in_right)
+    {
+        int img_x = box.x0 + i;
+        int img_y = box.y0 + j;
+        pixel_info p_info;
+        p_info.color[0] = planar.plane_row(planar_color_image::red, img_y)[img_x];
+        p_info.color[1] = planar.plane_row(planar_color_image::green, img_y)[img_x];
+        p_info.color[2] = planar.plane_row(planar_color_image::blue, img_y)[img_x];
+        p_info.saliency_value = planar.plane_row(planar_color_image::weight, img_y)[img_x];
+        p_info.x = box.x(i);
+        p_info.y = box.y(j);
+        if (in_left) { triangle_1.push_back(p_info); }
+        if (in_right) { triangle_2.push_back(p_info); }
+    });
+}
+// sample moments of the colors of both triangles of the box over the same stratified subset (weight = saliency + bias or 1)
+void sample_box_moments(const box_rasterizer& box, const planar_color_image& planar, bool use_saliency, int samples_per_triangle, sample_moments moments[2])
+{
+    box_sampler sampler(box, samples_per_triangle);
+    sampler.for_each_sample([&](int i, int j, bool in_left, bool in_right)
+    {
+        int img_x = box.x0 + i;
+        int img_y = box.y0 + j;
+        float color[3];
+        color[0] = planar.plane_row(planar_color_image::red, img_y)[img_x];
+        color[1] = planar.plane_row(planar_color_image::green, img_y)[img_x];
+        color[2] = planar.plane_row(planar_color_image::blue, img_y)[img_x];
+        float w = (use_saliency) ? planar.plane_row(planar_color_image::weight, img_y)[img_x] : 1.0f;
+        if (in_left) { moments[0].add(color, w); }
+        if (in_right) { moments[1].add(color, w); }
+    });
+}
+
+//  ----------------------------------------------------------------------------------------------------------------------------------------------
+// | adds the pixels [i_begin, i_end) of row j of the box that satisfy left_test to left_total and the ones that satisfy right_test to right_total |
+// | (a pixel can end up in both); the weight of a pixel is its saliency value if use_saliency is selected and 1 otherwise                        |
+//  ----------------------------------------------------------------------------------------------------------------------------------------------
+template <typename left_pixel_test, typename right_pixel_test>
+void accumulate_split_span(const box_rasterizer& box, int j, int i_begin, int i_end, const planar_color_image& planar, bool use_saliency, const left_pixel_test& left_test, const right_pixel_test& right_test, color_accumulator& left_total, color_accumulator& right_total)
+{
+    planar_row row = planar.row(box.y0 + j, use_saliency);
+    float y = box.y(j);
+    for (int i = i_begin; i < i_end; ++i)
+    {
+        float x = box.x(i);
+        if (left_test(x, y)) { left_total.add(row, box.x0 + i); }
+        if (right_test(x, y)) { right_total.add(row, box.x0 + i); }
     }
 }
+void accumulate_span(const box_rasterizer& box, int j, int i_begin, int i_end, const planar_color_image& planar, bool use_saliency, color_accumulator& total)
+{
+    total.add_span(planar.row(box.y0 + j, use_saliency), box.x0 + i_begin, i_end - i_begin);
+}
 
-//  -------------------------------------------------------------------------------------------------------------------------------------------
-// | given the a collection of pixels (pixel_info struct), it will return                                                                      |
-// | the average color over the pixels if saliency_mode is not selected                                                                        |
-// | the weighted average color over the pixels with weights being the saliency values of the corresponding pixel if saliency_mode is selected |
-//  -------------------------------------------------------------------------------------------------------------------------------------------
-void get_average_color(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, const cv::Mat& img, const cv::Mat& saliency_map, bool use_saliency, float average[3], const std::function<bool (float x, float y)> count_pixel)
+//  -----------------------------------------------------------------------------------------------------------------------
+// | [range_begin, range_end) = the pixels of the (non empty) span [i_begin, i_end) of row j that satisfy the test          |
+// | only for tests that are monotone along a row (true on a prefix or a suffix of the span, like the line splits), so the |
+// | border is found with a binary search on the exact same test instead of testing every pixel                            |
+//  -----------------------------------------------------------------------------------------------------------------------
+template <typename pixel_test>
+void monotone_test_range(const box_rasterizer& box, int j, int i_begin, int i_end, const pixel_test& test, int& range_begin, int& range_end)
 {
-    std::vector<pixel_info> triangle;
-    get_pixels_in_triangle(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, img, saliency_map, count_pixel, triangle);
+    float y = box.y(j);
+    bool first = test(box.x(i_begin), y);
+    bool last = test(box.x(i_end - 1), y);
+    if (first == last)
+    {
+        range_begin = i_begin;
+        range_end = (first) ? i_end : i_begin;
+        return;
+    }
 
-    average[0] = std::accumulate(triangle.begin(), triangle.end(), 0.0f, [use_saliency](float s, pixel_info v){ return (use_saliency) ? s + v.color[0] * v.saliency_value : s + v.color[0]; });
-    average[1] = std::accumulate(triangle.begin(), triangle.end(), 0.0f, [use_saliency](float s, pixel_info v){ return (use_saliency) ? s + v.color[1] * v.saliency_value : s + v.color[1]; });
-    average[2] = std::accumulate(triangle.begin(), triangle.end(), 0.0f, [use_saliency](float s, pixel_info v){ return (use_saliency) ? s + v.color[2] * v.saliency_value : s + v.color[2]; });
-    
-    float divv = (use_saliency) ? std::accumulate(triangle.begin(), triangle.end(), 0.0f, [](float s, pixel_info v){ return s + v.saliency_value; }) : triangle.size();
-    average[0] /= (divv * 255.0f);
-    average[1] /= (divv * 255.0f);
-    average[2] /= (divv * 255.0f);
+    // test(lo) == first and test(hi) != first
+    int lo = i_begin;
+    int hi = i_end - 1;
+    while (hi - lo > 1)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (test(box.x(mid), y) == first) { lo = mid; }
+        else { hi = mid; }
+    }
+    range_begin = (first) ? i_begin : hi;
+    range_end = (first) ? hi : i_end;
+}
+// same as accumulate_split_span, but for monotone tests (see monotone_test_range) so both sides are plain spans
+template <typename left_pixel_test, typename right_pixel_test>
+void accumulate_monotone_split_span(const box_rasterizer& box, int j, int i_begin, int i_end, const planar_color_image& planar, bool use_saliency, const left_pixel_test& left_test, const right_pixel_test& right_test, color_accumulator& left_total, color_accumulator& right_total)
+{
+    int range_begin, range_end;
+    monotone_test_range(box, j, i_begin, i_end, left_test, range_begin, range_end);
+    accumulate_span(box, j, range_begin, range_end, planar, use_saliency, left_total);
+    monotone_test_range(box, j, i_begin, i_end, right_test, range_begin, range_end);
+    accumulate_span(box, j, range_begin, range_end, planar, use_saliency, right_total);
+}
+
+//  --------------------------------------------------------------------------------------------------------------------
+// | gathers the (weighted) color sums at either side of the split curves of both triangles of a box in a single pass   |
+// | totals[t][0] = left/below side of the split of triangle t (0 = left triangle, 1 = right triangle)                 |
+// | totals[t][1] = right/above side; a triangle without a split puts all its pixels in totals[t][0]                   |
+//  --------------------------------------------------------------------------------------------------------------------
+void accumulate_box_split_colors(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, const planar_color_image& planar, bool use_saliency, const triangle_split splits[2], color_accumulator totals[2][2])
+{
+    box_rasterizer box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, planar.cols, planar.rows);
+    box.for_each_span([&](int j, int i_begin, int i_end, bool left_triangle)
+    {
+        const triangle_split& split = splits[(left_triangle) ? 0 : 1];
+        color_accumulator* total = totals[(left_triangle) ? 0 : 1];
+        switch (split.type)
+        {
+            case no_split:
+                accumulate_span(box, j, i_begin, i_end, planar, use_saliency, total[0]);
+                break;
+            case linear_split:
+            {
+                linear_split_test<whole_box_test, true> test_left = {whole_box_test(), split.c0, split.c1};
+                linear_split_test<whole_box_test, false> test_right = {whole_box_test(), split.c0, split.c1};
+                accumulate_monotone_split_span(box, j, i_begin, i_end, planar, use_saliency, test_left, test_right, total[0], total[1]);
+                break;
+            }
+            case vertical_split:
+            {
+                vertical_split_test<whole_box_test, true> test_left = {whole_box_test(), (float)split.c0};
+                vertical_split_test<whole_box_test, false> test_right = {whole_box_test(), (float)split.c0};
+                accumulate_monotone_split_span(box, j, i_begin, i_end, planar, use_saliency, test_left, test_right, total[0], total[1]);
+                break;
+            }
+            case quadratic_split:
+            {
+                quadratic_split_test<whole_box_test, true> test_left = {whole_box_test(), (float)split.c0, (float)split.c1, (float)split.c2};
+                quadratic_split_test<whole_box_test, false> test_right = {whole_box_test(), (float)split.c0, (float)split.c1, (float)split.c2};
+                accumulate_split_span(box, j, i_begin, i_end, planar, use_saliency, test_left, test_right, total[0], total[1]);
+                break;
+            }
+        }
+    });
+}
+
+//  ---------------------------------------------------------------------------------------------------------------------------
+// | writes the average colors at either side of the split curve of a triangle to the uniform buffers                        |
+// | no split -> the average color over the whole triangle is used for both                                                  |
+// | if there is not enough pixels in either area, then the color of the other area is used (the triangle is 1 color again) |
+// | returns the (weighted) squared error of the triangle with those colors (r + g + b, colors [0, 1])                     |
+//  ---------------------------------------------------------------------------------------------------------------------------
+double update_split_colors(const triangle_split& split, const color_accumulator totals[2], float triangle_colors1[], float triangle_colors2[])
+{
+    float total[3];
+    float total_2[3];
+    totals[0].average(total);
+    if (split.type == no_split)
+    {
+        std::copy(total, total + 3, total_2);
+    }
+    else
+    {
+        totals[1].average(total_2);
+        if (std::isnan(total[0])) { std::copy(total_2, total_2 + 3, total); }
+        if (std::isnan(total_2[0])) { std::copy(total, total + 3, total_2); }
+    }
+    triangle_colors1[0] = total[0];
+    triangle_colors1[1] = total[1];
+    triangle_colors1[2] = total[2];
+    triangle_colors2[0] = total_2[0];
+    triangle_colors2[1] = total_2[1];
+    triangle_colors2[2] = total_2[2];
+    return totals[0].squared_error(total) + ((split.type == no_split) ? 0.0 : totals[1].squared_error(total_2));
 }
 
 //  ----------------------------------------------------------------------------------------------------------------------------------------
-// | given an edge map and bounding box coordinates, it gets the edge coordinates in bounding box coord space used in the pixel_info struct |
-// | then it sorts those edge coordinates in two group; the pixel is covered by the "left/bottom" triangle or the "right/top" triangle      |
+// | given an edge map and bounding box coordinates, it visits the edge pixels in the box with their bounding box coord space coordinates  |
+// | (as used in the pixel_info struct): edge_func(x, y, in_left, in_right), in_left/in_right = covered by the "left/bottom"/"right/top"    |
+// | triangle (both for a pixel on the diagonal)                                                                                           |
 //  ----------------------------------------------------------------------------------------------------------------------------------------
-void get_edge_points_box(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, const cv::Mat& edges, std::vector<double>& x_points_1, std::vector<double>& y_points_1, std::vector<double>& x_points_2, std::vector<double>& y_points_2)
+template <typename edge_function>
+void for_each_edge_point_box(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, const cv::Mat& edges, edge_function&& edge_func)
 {
     float top_right_x_pixels = bottom_left_x_pixels + width_triangle_pixels;
     float top_right_y_pixels = bottom_left_y_pixels + height_triangle_pixels;
 
     int y_start = std::floor(bottom_left_y_pixels);
     int x_start = std::floor(bottom_left_x_pixels);
-    int y_width = std::floor(top_right_y_pixels) - y_start;
-    int x_width = std::floor(top_right_x_pixels) - x_start;
+    int y_end = std::floor(top_right_y_pixels);
+    int x_end = std::floor(top_right_x_pixels);
+    int y_width = y_end - y_start;
+    int x_width = x_end - x_start;
 
-    // loop through all pixels in box; add edge pixels to set of points
-    for (int y1 = y_start; y1 < std::floor(top_right_y_pixels); ++y1)
+    // loop through all pixels in box; report the edge pixels
+    for (int y1 = y_start; y1 < y_end; ++y1)
     {
-        for (int x1 = x_start; x1 < std::floor(top_right_x_pixels); ++x1)
+        const unsigned char* edge_row = edges.ptr<unsigned char>(y1);
+        for (int x1 = x_start; x1 < x_end; ++x1)
         {
-            int val = (int)edges.at<unsigned char>(y1, x1);
-            if (val > 0)
+            if (edge_row[x1] > 0)
             {
                 float x2 = ((float)x1 - (float)x_start + 0.5f) / (float)x_width;
                 float y2 = ((float)y1 - (float)y_start + 0.5f) / (float)y_width;
                 float pos = x2 + y2;
-                if (pos <= 1.0f)
-                {
-                    x_points_1.push_back(x2);
-                    y_points_1.push_back(y2);
-                }
-                if (pos >= 1.0f)
-                {
-                    x_points_2.push_back(x2);
-                    y_points_2.push_back(y2);
-                }
+                edge_func(x2, y2, pos <= 1.0f, pos >= 1.0f);
             }
         }
     }
 }
+// streams the edge coordinates of for_each_edge_point_box into the moments (line_moments or quadratic_moments) of the "left/bottom" (moments[0]) and "right/top" (moments[1]) triangle
+template <typename edge_moments>
+void get_edge_moments_box(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, const cv::Mat& edges, edge_moments moments[2])
+{
+    for_each_edge_point_box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, edges, [&](float x, float y, bool in_left, bool in_right)
+    {
+        if (in_left) { moments[0].add(x, y); }
+        if (in_right) { moments[1].add(x, y); }
+    });
+}
 
 //  ---------------------------------------------------------------------------------------------------
 // | converts the (x, y) boxcoords used in the pixel_info struct to the corresponding                  |
 // | barycentric coordinates of the given triangle (left or right)                                     |
 // | left triangle = given a square a "left" triangle covers all vertices except the top right one     |
 // | right triangle = given a square a "right" triangle covers all vertices except the bottom left one |
+// | the result is written to res (cleared first), so the caller can reuse its buffer                  |
 //  ---------------------------------------------------------------------------------------------------
-std::vector<barycentric_coordinates> convert_to_barycentric(const std::vector<pixel_info>& triangle, bool left_triangle)
+void convert_to_barycentric(const std::vector<pixel_info>& triangle, bool left_triangle, std::vector<barycentric_coordinates>& res)
 {
-    std::vector<barycentric_coordinates> res;
+    res.clear();
     for (auto const &v : triangle)
     {
         barycentric_coordinates b;
@@ -575,13 +1152,45 @@ std::vector<barycentric_coordinates> convert_to_barycentric(const std::vector<pi
         }
         res.push_back(b);
     }
-    return res;
+}
+
+//  -----------------------------------------------------------------------------------------------------------------
+// | adds every pixel of the box to the normal equations of its triangle (0 = left, 1 = right), read straight from the |
+// | planar image with the same barycentric coordinates as convert_to_barycentric (weighted with use_saliency)         |
+//  -----------------------------------------------------------------------------------------------------------------
+template <int n>
+void add_box_pixels(const box_rasterizer& box, const planar_color_image& planar, bool use_saliency, bezier_normal_equations<n> equations[2])
+{
+    box.for_each_span([&](int j, int i_begin, int i_end, bool left_triangle)
+    {
+        const float* red_row = planar.plane_row(planar_color_image::red, box.y0 + j) + box.x0;
+        const float* green_row = planar.plane_row(planar_color_image::green, box.y0 + j) + box.x0;
+        const float* blue_row = planar.plane_row(planar_color_image::blue, box.y0 + j) + box.x0;
+        const float* weight_row = (use_saliency) ? planar.plane_row(planar_color_image::weight, box.y0 + j) + box.x0 : nullptr;
+        float y = box.y(j);
+        for (int i = i_begin; i < i_end; ++i)
+        {
+            float x = box.x(i);
+            float color[3] = {red_row[i], green_row[i], blue_row[i]};
+            float weight = (weight_row) ? weight_row[i] : 1.0f;
+            if (left_triangle) { equations[0].add(1.0f - y - x, x, y, color, weight); }
+            else
+            {
+                float s = 1.0f - y;
+                float t = 1.0f - x;
+                equations[1].add(s, t, 1.0f - s - t, color, weight);
+            }
+        }
+    });
 }
 
 //  ---------------------------------------------------------------------
 // | coloring method: bilinear interpolation (no opt)                    |
 // | for each vertex it gets the color at that point in the actual image |
 // | and updates the vertex color attribute in the vertex buffer         |
+// | the squared error of the linear interpolation over every triangle   |
+// | is the one of a degree 1 bezier triangle with the vertex colors as  |
+// | control points (one pass over the pixels, only for the error map)   |
 //  ---------------------------------------------------------------------
 void update_vertex_colors(const update_coloring_info& coloring_info, float vertices[], float vertex_colors[])
 {
@@ -601,35 +1210,65 @@ void update_vertex_colors(const update_coloring_info& coloring_info, float verti
             int y_coor = std::floor((y * y_step) * coloring_info.img.rows);
             x_coor = (x_coor == coloring_info.img.cols) ? coloring_info.img.cols - 1 : x_coor;
             y_coor = (y_coor == coloring_info.img.rows) ? coloring_info.img.rows - 1 : y_coor;
-            cv::Vec3b val = coloring_info.img.at<cv::Vec3b>(y_coor, x_coor);
+            float val[3];
+            coloring_info.planar.color(x_coor, y_coor, val);
 
             // set colors
-            vertex_colors[base_index + 0] = val[2] / 255.0;
-            vertex_colors[base_index + 1] = val[1] / 255.0;
-            vertex_colors[base_index + 2] = val[0] / 255.0;
+            vertex_colors[base_index + 0] = val[0];
+            vertex_colors[base_index + 1] = val[1];
+            vertex_colors[base_index + 2] = val[2];
 
-            vertices[base_index * 2 + 3] = val[2] / 255.0;
-            vertices[base_index * 2 + 4] = val[1] / 255.0;
-            vertices[base_index * 2 + 5] = val[0] / 255.0;
+            vertices[base_index * 2 + 3] = val[0];
+            vertices[base_index * 2 + 4] = val[1];
+            vertices[base_index * 2 + 5] = val[2];
         }
     }
+
+    if (!coloring_info.triangle_errors) { return; }
+    float width_triangle_pixels = (float)coloring_info.img.cols / (float)(x_max - 1);
+    float height_triangle_pixels = (float)coloring_info.img.rows / (float)(y_max - 1);
+    coloring_pool().parallel_for(0, y_max - 1, [&](int y)
+    {
+        for (int x = 0; x < x_max - 1; x++)
+        {
+            unsigned int bottom_left = x_max * y + x;
+            unsigned int corners[2][3] = {{bottom_left + x_max, bottom_left + 1, bottom_left}, // left triangle: u (top left), t (bottom right), s (bottom left)
+                                          {bottom_left + x_max + 1, bottom_left + x_max, bottom_left + 1}}; // right triangle: u (top right), t (top left), s (bottom right)
+            float bottom_left_x_pixels = (float)(vertices[bottom_left * 6] * coloring_info.img.cols);
+            float bottom_left_y_pixels = (float)(vertices[bottom_left * 6 + 1] * coloring_info.img.rows);
+            box_rasterizer box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.planar.cols, coloring_info.planar.rows);
+            bezier_normal_equations<1> equations[2];
+            add_box_pixels(box, coloring_info.planar, coloring_info.use_saliency, equations);
+            for (int side = 0; side < 2; ++side)
+            {
+                double error = 0.0;
+                for (int c = 0; c < 3; ++c)
+                {
+                    double control_points[3];
+                    for (int k = 0; k < 3; ++k) { control_points[k] = vertex_colors[corners[side][k] * 3 + c]; }
+                    error += equations[side].squared_residual(c, control_points);
+                }
+                coloring_info.triangle_errors[(x + y * (x_max - 1)) * 2 + side] = (float)error;
+            }
+        }
+    });
 }
 
 //  ----------------------------------------------------------------------------------------------------------------------------------
 // | coloring method: constant color (average)                                                                                        |
-// | for each triangle it gets the pixels inside the triangle with their corresponding saliency value                                 |
-// | if saliency_mode is turned on -> compute the weighted average of the collected pixels with their corresponding saliency value    |
-// | if saliency_mode is turned off -> computes the normal average of the collected pixels colors                                     |
+// | for each triangle it gets the sum of the pixels inside the triangle from the precomputed prefix sums (triangle_sum_table)       |
+// | if saliency_mode is turned on -> compute the weighted average of the pixels with their corresponding saliency value             |
+// | if saliency_mode is turned off -> computes the normal average of the pixels colors                                               |
 // | stores those values in a uniform buffer which can be accessed later in the glsl shader by their gl_PrimitiveID (triangle number) |
 //  ----------------------------------------------------------------------------------------------------------------------------------
-void update_constant_colors(const update_coloring_info& coloring_info, const float vertices[], float triangle_colors1[])
+void update_constant_colors(const update_coloring_info& coloring_info, const triangle_sum_table& triangle_sums, const float vertices[], float triangle_colors1[])
 {
     int x_max = coloring_info.num_triangles_x;
     int y_max = coloring_info.num_triangles_y;
     float width_triangle_pixels = (float)coloring_info.img.cols / (float)x_max;
     float height_triangle_pixels = (float)coloring_info.img.rows / (float)y_max;
 
-    for (int y = 0; y < y_max; y++)
+    coloring_pool().parallel_for(0, y_max, [&](int y)
     {
         for (int x = 0; x < x_max; x++)
         {
@@ -642,8 +1281,15 @@ void update_constant_colors(const update_coloring_info& coloring_info, const flo
 
             float average_1[3];
             float average_2[3];
-            get_average_color(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.img, coloring_info.saliency_map, coloring_info.use_saliency, average_1, [](float x, float y) {return x + y <= 1.0f;});
-            get_average_color(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.img, coloring_info.saliency_map, coloring_info.use_saliency, average_2, [](float x, float y) {return x + y >= 1.0f;});
+            double squared_errors[2];
+            bool errors = coloring_info.triangle_errors != nullptr;
+            triangle_sums.triangle_average(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, true, average_1, (errors) ? &squared_errors[0] : nullptr);
+            triangle_sums.triangle_average(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, false, average_2, (errors) ? &squared_errors[1] : nullptr);
+            if (errors)
+            {
+                coloring_info.triangle_errors[(x + (y * x_max)) * 2] = (float)squared_errors[0];
+                coloring_info.triangle_errors[(x + (y * x_max)) * 2 + 1] = (float)squared_errors[1];
+            }
 
             int basee = (x + (y * x_max)) * 6;
             triangle_colors1[basee + 0] = average_1[0];
@@ -653,6 +1299,79 @@ void update_constant_colors(const update_coloring_info& coloring_info, const flo
             triangle_colors1[basee + 4] = average_2[1];
             triangle_colors1[basee + 5] = average_2[2];
         }
+    });
+}
+
+//  ------------------------------------------------------------------------------------------------------------------------------------
+// | coloring method: constant color (average) over a stratified subset of the pixels of every triangle (see box_sampler)               |
+// | uses target_samples per triangle, or (with use_error_bound) as many as needed to get the error bound of the average below          |
+// | error_bound (one extra pass with the number of samples estimated from the first pass); the reached error bound is added to report |
+//  ------------------------------------------------------------------------------------------------------------------------------------
+void update_sampled_constant_colors(const update_coloring_info& coloring_info, const float vertices[], float triangle_colors1[], sampling_report& report)
+{
+    int x_max = coloring_info.num_triangles_x;
+    int y_max = coloring_info.num_triangles_y;
+    float width_triangle_pixels = (float)coloring_info.img.cols / (float)x_max;
+    float height_triangle_pixels = (float)coloring_info.img.rows / (float)y_max;
+    const sampling_settings& sampling = coloring_info.sampling;
+
+    // per triangle results, combined in the report after the parallel loop
+    std::vector<int> num_samples(x_max * y_max * 2);
+    std::vector<int> num_pixels(x_max * y_max * 2);
+    std::vector<double> errors(x_max * y_max * 2);
+
+    coloring_pool().parallel_for(0, y_max, [&](int y)
+    {
+        for (int x = 0; x < x_max; x++)
+        {
+            // (x_max + 1) becuase the rightmost vertices are already tested in the previous box
+            unsigned int bottom_left = (x_max + 1) * y + x;
+
+            // top left = (0, 0), top right = (0, img.cols - 1), bottom left = (img.rows - 1, 0)
+            float bottom_left_x_pixels = (float)(vertices[bottom_left * 6] * coloring_info.img.cols);
+            float bottom_left_y_pixels = (float)(vertices[bottom_left * 6 + 1] * coloring_info.img.rows);
+
+            box_rasterizer box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.planar.cols, coloring_info.planar.rows);
+            int pixel_counts[2];
+            count_triangle_pixels(box, pixel_counts);
+
+            sample_moments moments[2];
+            sample_box_moments(box, coloring_info.planar, coloring_info.use_saliency, sampling.target_samples, moments);
+            if (sampling.use_error_bound)
+            {
+                int needed = std::max(samples_for_error_bound(moments[0].count, moments[0].error_bound(pixel_counts[0]), sampling.error_bound),
+                                      samples_for_error_bound(moments[1].count, moments[1].error_bound(pixel_counts[1]), sampling.error_bound));
+                if (needed > std::max(moments[0].count, moments[1].count))
+                {
+                    moments[0] = sample_moments();
+                    moments[1] = sample_moments();
+                    sample_box_moments(box, coloring_info.planar, coloring_info.use_saliency, needed, moments);
+                }
+            }
+
+            int basee = (x + (y * x_max)) * 6;
+            moments[0].average(&triangle_colors1[basee]);
+            moments[1].average(&triangle_colors1[basee + 3]);
+
+            int triangle = (x + (y * x_max)) * 2;
+            for (int t = 0; t < 2; ++t)
+            {
+                num_samples[triangle + t] = moments[t].count;
+                num_pixels[triangle + t] = pixel_counts[t];
+                errors[triangle + t] = moments[t].error_bound(pixel_counts[t]);
+                // the squared error of the samples, scaled up to all pixels of the triangle
+                if (coloring_info.triangle_errors && moments[t].count > 0)
+                {
+                    coloring_info.triangle_errors[triangle + t] = (float)(moments[t].squared_error() * pixel_counts[t] / moments[t].count);
+                }
+            }
+        }
+    });
+
+    report = sampling_report();
+    for (int i = 0; i < (int)errors.size(); ++i)
+    {
+        report.add_triangle(num_samples[i], num_pixels[i], errors[i]);
     }
 }
 
@@ -670,7 +1389,7 @@ void update_triangle_center_colors(const update_coloring_info& coloring_info, co
     float width_triangle_pixels = (float)coloring_info.img.cols / (float)x_max;
     float height_triangle_pixels = (float)coloring_info.img.rows / (float)y_max;
 
-    for (int y = 0; y < y_max; y++)
+    coloring_pool().parallel_for(0, y_max, [&](int y)
     {
         for (int x = 0; x < x_max; x++)
         {
@@ -684,61 +1403,59 @@ void update_triangle_center_colors(const update_coloring_info& coloring_info, co
             // find center triangle 1
             int x1 = std::floor((0.35355 * width_triangle_pixels) + bottom_left_x_pixels);
             int y1 = std::floor((0.35355 * height_triangle_pixels) + bottom_left_y_pixels);
-            cv::Vec3b val1 = coloring_info.img.at<cv::Vec3b>(y1, x1);
+            float val1[3];
+            coloring_info.planar.color(x1, y1, val1);
             // find center triangle 2
             int x2 = std::floor(((1-0.35355) * width_triangle_pixels) + bottom_left_x_pixels);
             int y2 = std::floor(((1-0.35355) * height_triangle_pixels) + bottom_left_y_pixels);
-            cv::Vec3b val2 = coloring_info.img.at<cv::Vec3b>(y2, x2);
+            float val2[3];
+            coloring_info.planar.color(x2, y2, val2);
+
+            // squared error of the center colors over all pixels of the triangles (one pass over the box, only for the error map)
+            if (coloring_info.triangle_errors)
+            {
+                box_rasterizer box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.planar.cols, coloring_info.planar.rows);
+                color_accumulator totals[2];
+                box.for_each_span([&](int j, int i_begin, int i_end, bool left_triangle) { accumulate_span(box, j, i_begin, i_end, coloring_info.planar, coloring_info.use_saliency, totals[(left_triangle) ? 0 : 1]); });
+                coloring_info.triangle_errors[(x + (y * x_max)) * 2] = (float)totals[0].squared_error(val1);
+                coloring_info.triangle_errors[(x + (y * x_max)) * 2 + 1] = (float)totals[1].squared_error(val2);
+            }
 
             int basee = (x + (y * x_max)) * 6;
-            triangle_colors1[basee + 0] = val1[2] / 255.0;
-            triangle_colors1[basee + 1] = val1[1] / 255.0;
-            triangle_colors1[basee + 2] = val1[0] / 255.0;
-            triangle_colors1[basee + 3] = val2[2] / 255.0;
-            triangle_colors1[basee + 4] = val2[1] / 255.0;
-            triangle_colors1[basee + 5] = val2[0] / 255.0;
+            triangle_colors1[basee + 0] = val1[0];
+            triangle_colors1[basee + 1] = val1[1];
+            triangle_colors1[basee + 2] = val1[2];
+            triangle_colors1[basee + 3] = val2[0];
+            triangle_colors1[basee + 4] = val2[1];
+            triangle_colors1[basee + 5] = val2[2];
         }
-    }
+    });
 }
 
-//  ---------------------------------------------------------------------------------------------------------------------
-// | used by function update_linear_split_constant_color as the bulk of the computation                                  |
-// | a line is approximates from a list of edge pixel coordinates if there are more than num_edge_detection_points found |
-// | if there is a line -> compute the average color at either side of that line                                         |
-// | if there is no line -> compute the average color over the whole triangle                                            |
-// | puts those line variables and colors in the uniform buffer to be used by the shader to render the image             |
-//  ---------------------------------------------------------------------------------------------------------------------
-void compute_line_and_update_colors(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, const cv::Mat& img, const cv::Mat& saliency_map, bool use_saliency, float triangle_colors1[], float triangle_colors2[], float variable_per_triangles[], int num_edge_detection_points, const std::function<bool (float x, float y)> which_triangle, bool left_triangle, std::vector<double>& x_points, std::vector<double>& y_points)
+//  -----------------------------------------------------------------------------------------------------------------------------
+// | used by function update_linear_split_constant_color                                                                         |
+// | a line is approximates from the moments of the edge pixel coordinates if there are more than num_edge_detection_points found |
+// | (closed form least squares: c1 = Sxy / Sxx, c0 = mean y - c1 * mean x; vertical line when all points have the same x)       |
+// | puts the line variables in the uniform buffer to be used by the shader to render the image                                  |
+// | returns the split of the triangle (no_split if there are not enough points)                                                 |
+//  -----------------------------------------------------------------------------------------------------------------------------
+triangle_split compute_line_split(int num_edge_detection_points, const line_moments& moments, float variable_per_triangles[])
 {
-    float total[3] = {0.0, 0.0, 0.0};
-    float total_2[3] = {0.0, 0.0, 0.0};
-    if ((int)x_points.size() < num_edge_detection_points)
+    triangle_split split;
+    if (moments.count < num_edge_detection_points)
     {
         // not enough points -> don't split the triangle and make it a constant color
-        get_average_color(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, img, saliency_map, use_saliency, total, which_triangle);
-        triangle_colors1[0] = total[0];
-        triangle_colors1[1] = total[1];
-        triangle_colors1[2] = total[2];
-
-        triangle_colors2[0] = total[0];
-        triangle_colors2[1] = total[1];
-        triangle_colors2[2] = total[2];
-
         variable_per_triangles[0] = 0.0f;
         variable_per_triangles[1] = 0.0f;
         variable_per_triangles[2] = 0.0f; // not used
     }
     else
     {
-        double c0, c1, cov00, cov01, cov11, sumsq;
-        gsl_fit_linear(&x_points[0], 1, &y_points[0], 1, x_points.size(), &c0, &c1, &cov00, &cov01, &cov11, &sumsq);
-        std::function<bool (float x, float y)> test_func_left;
-        std::function<bool (float x, float y)> test_func_right;
-        if (std::isnan(c0) || std::isnan(c1))
+        if (moments.x_min == moments.x_max)
         {
-            float x_line = (float)x_points[0];
-            test_func_left = [which_triangle, x_line](float x, float y) { return (which_triangle(x, y) && x <= x_line);};
-            test_func_right = [which_triangle, x_line](float x, float y) { return (which_triangle(x, y) && x >= x_line);};
+            float x_line = (float)moments.x_min;
+            split.type = vertical_split;
+            split.c0 = x_line;
 
             variable_per_triangles[0] = x_line;
             variable_per_triangles[1] = 0.0f;
@@ -746,120 +1463,58 @@ void compute_line_and_update_colors(float bottom_left_x_pixels, float bottom_lef
         }
         else
         {
-            test_func_left = [which_triangle, c0, c1](float x, float y) { return (which_triangle(x, y) && c0 + c1 * x >= y);};
-            test_func_right = [which_triangle, c0, c1](float x, float y) { return (which_triangle(x, y) && c0 + c1 * x <= y);};
+            double n = moments.count;
+            double sxx = moments.xx_sum - moments.x_sum * moments.x_sum / n;
+            double sxy = moments.xy_sum - moments.x_sum * moments.y_sum / n;
+            double c1 = sxy / sxx;
+            double c0 = (moments.y_sum - c1 * moments.x_sum) / n;
+
+            split.type = linear_split;
+            split.c0 = c0;
+            split.c1 = c1;
 
             variable_per_triangles[0] = c0;
             variable_per_triangles[1] = c1;
             variable_per_triangles[2] = 0.0f; // tell to shader that this is not a vertical line
         }
-
-        get_average_color(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, img, saliency_map, use_saliency, total, test_func_left);
-        get_average_color(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, img, saliency_map, use_saliency, total_2, test_func_right);
-        // if there is not enough pixels in either area, then just take the color of the other area effectively makin the triangle 1 color again
-        if (std::isnan(total[0])) { std::copy(total_2, total_2+3, total); }
-        if (std::isnan(total_2[0])) { std::copy(total, total+3, total_2); }
-        triangle_colors1[0] = total[0];
-        triangle_colors1[1] = total[1];
-        triangle_colors1[2] = total[2];
-        triangle_colors2[0] = total_2[0];
-        triangle_colors2[1] = total_2[1];
-        triangle_colors2[2] = total_2[2];
     }
+    return split;
 }
 
-// 
-//  --------------------------------------------------------------------------------------------------------------------------------
-// | used by function update_quadratic_split_constant_color as the bulk of the computation                                          |
-// | approximates a quadratic equation from a list of edge pixel coordinates if there are more than num_edge_detection_points found |
-// | if there is a fit -> compute the average color at either side of that equation                                                 |
-// | if there is no fit -> compute the average color over the whole triangle                                                        |
-// | puts those line variables and colors in the uniform buffer to be used by the shader to render the image                        |
-//  --------------------------------------------------------------------------------------------------------------------------------
-void compute_quadratic_and_update_colors(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, const cv::Mat& img, const cv::Mat& saliency_map, bool use_saliency, float triangle_colors1[], float triangle_colors2[], float variable_per_triangles[], int num_edge_detection_points, std::function<bool (float x, float y)> which_triangle, bool left_triangle, std::vector<double>& x_points, std::vector<double>& y_points)
+//  -----------------------------------------------------------------------------------------------------------------------------------------
+// | used by function update_quadratic_split_constant_color                                                                                  |
+// | approximates a quadratic equation from the moments of the edge pixel coordinates if there are more than num_edge_detection_points found |
+// | puts the equation variables in the uniform buffer to be used by the shader to render the image                                          |
+// | returns the split of the triangle (no_split if there are not enough points or the fit has no finite solution)                           |
+//  -----------------------------------------------------------------------------------------------------------------------------------------
+triangle_split compute_quadratic_split(int num_edge_detection_points, const quadratic_moments& moments, float variable_per_triangles[])
 {
-    float total[3] = {0.0, 0.0, 0.0};
-    float total_2[3] = {0.0, 0.0, 0.0};
-    if ((int)x_points.size() < 10)
+    triangle_split split;
+    double c[3];
+    if (moments.count < 10 || !moments.solve(c))
     {
-        // not enough points -> don't split the triangle and make it a constant color
-        get_average_color(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, img, saliency_map, use_saliency, total, which_triangle);
-        triangle_colors1[0] = total[0];
-        triangle_colors1[1] = total[1];
-        triangle_colors1[2] = total[2];
-
-        triangle_colors2[0] = total[0];
-        triangle_colors2[1] = total[1];
-        triangle_colors2[2] = total[2];
-
+        // not enough points (or no solution) -> don't split the triangle and make it a constant color
         variable_per_triangles[0] = 0.0f;
         variable_per_triangles[1] = 0.0f;
         variable_per_triangles[2] = 0.0f; // not used
     }
     else
     {
-        int n = (int)x_points.size();
-        double chisq;
-        gsl_matrix *X, *cov;
-        gsl_vector *y, *c;
-
-        X = gsl_matrix_alloc(n, 3);
-        y = gsl_vector_alloc(n);
-        // w = gsl_vector_alloc(n);
-        c = gsl_vector_alloc(3);
-        cov = gsl_matrix_alloc(3, 3);
-
-        for (int i = 0; i < n; ++i)
-        {
-            gsl_matrix_set(X, i, 0, 1.0);
-            gsl_matrix_set(X, i, 1, x_points[i]);
-            gsl_matrix_set(X, i, 2, x_points[i] * x_points[i]);
-
-            gsl_vector_set(y, i, y_points[i]);
-        }
-        gsl_multifit_linear_workspace* work = gsl_multifit_linear_alloc(n, 3);
-        gsl_multifit_linear(X, y, c, cov, &chisq, work);
-
         // y = c0 + c1*x + c2*x*x
-        float c0 = (float)gsl_vector_get(c, (0));
-        float c1 = (float)gsl_vector_get(c, (1));
-        float c2 = (float)gsl_vector_get(c, (2));
-
-        gsl_multifit_linear_free(work);
-        gsl_matrix_free(X);
-        gsl_vector_free(y);
-        gsl_vector_free(c);
-        gsl_matrix_free(cov);
-
-        if (std::isnan(c0) || std::isnan(c1) || std::isnan(c2))
-        {
-            std::copy(x_points.begin(), x_points.end(), std::ostream_iterator<float>(std::cout, " "));
-            std::copy(y_points.begin(), y_points.end(), std::ostream_iterator<float>(std::cout, " "));
-            std::cout << std::endl;
-        }
+        float c0 = (float)c[0];
+        float c1 = (float)c[1];
+        float c2 = (float)c[2];
 
-        std::function<bool (float x, float y)> test_func_left;
-        std::function<bool (float x, float y)> test_func_right;
-
-        test_func_left = [which_triangle, c0, c1, c2](float x, float y) { return (which_triangle(x, y) && c0 + (c1 * x) + (c2 * x * x) >= y);};
-        test_func_right = [which_triangle, c0, c1, c2](float x, float y) { return (which_triangle(x, y) && c0 + (c1 * x)  + (c2 * x * x) <= y);};
+        split.type = quadratic_split;
+        split.c0 = c0;
+        split.c1 = c1;
+        split.c2 = c2;
 
         variable_per_triangles[0] = c0;
         variable_per_triangles[1] = c1;
         variable_per_triangles[2] = c2;
-
-        get_average_color(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, img, saliency_map, use_saliency, total, test_func_left);
-        get_average_color(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, img, saliency_map, use_saliency, total_2, test_func_right);
-        // if there is not enough pixels in either area, then just take the color of the other area effectively makin the triangle 1 color again
-        if (std::isnan(total[0])) { std::copy(total_2, total_2+3, total); }
-        if (std::isnan(total_2[0])) { std::copy(total, total+3, total_2); }
-        triangle_colors1[0] = total[0];
-        triangle_colors1[1] = total[1];
-        triangle_colors1[2] = total[2];
-        triangle_colors2[0] = total_2[0];
-        triangle_colors2[1] = total_2[1];
-        triangle_colors2[2] = total_2[2];
     }
+    return split;
 }
 
 //  ---------------------------------------------------------------------------------------------------------
@@ -877,31 +1532,40 @@ void update_linear_split_constant_color(const update_coloring_info& coloring_inf
     float width_triangle_pixels = (float)coloring_info.img.cols / (float)x_max;
     float height_triangle_pixels = (float)coloring_info.img.rows / (float)y_max;
 
-    for (int y = 0; y < y_max; y++)
+    // one task per box (the cost of a box depends a lot on the number of edge pixels in it), balanced with work stealing
+    coloring_pool().parallel_for_stealing(0, x_max * y_max, [&](int box)
     {
-        for (int x = 0; x < x_max; x++)
+        int x = box % x_max;
+        int y = box / x_max;
+
+        // (x_max + 1) becuase the rightmost vertices are already tested in the previous box
+        unsigned int bottom_left = (x_max + 1) * y + x;
+
+        // top left = (0, 0), top right = (0, img.cols - 1), bottom left = (img.rows - 1, 0)
+        float bottom_left_x_pixels = (float)(vertices[bottom_left * 6] * coloring_info.img.cols);
+        float bottom_left_y_pixels = (float)(vertices[bottom_left * 6 + 1] * coloring_info.img.rows);
+
+        // line moments of the edge points of both triangles in the box (one streaming pass, no point lists)
+        line_moments moments[2];
+        get_edge_moments_box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, edges, moments);
+
+        int basee = (x + (y * x_max)) * 6;
+        triangle_split splits[2];
+        splits[0] = compute_line_split(num_edge_detection_points, moments[0], &triangle_colors[2][basee]);
+        splits[1] = compute_line_split(num_edge_detection_points, moments[1], &triangle_colors[2][basee + 3]);
+
+        // average color at either side of the split curves of both triangles in one pass over the box
+        color_accumulator totals[2][2];
+        accumulate_box_split_colors(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.planar, coloring_info.use_saliency, splits, totals);
+        double squared_errors[2];
+        squared_errors[0] = update_split_colors(splits[0], totals[0], &triangle_colors[0][basee], &triangle_colors[1][basee]);
+        squared_errors[1] = update_split_colors(splits[1], totals[1], &triangle_colors[0][basee + 3], &triangle_colors[1][basee + 3]);
+        if (coloring_info.triangle_errors)
         {
-            // (x_max + 1) becuase the rightmost vertices are already tested in the previous box
-            unsigned int bottom_left = (x_max + 1) * y + x;
-
-            // top left = (0, 0), top right = (0, img.cols - 1), bottom left = (img.rows - 1, 0)
-            float bottom_left_x_pixels = (float)(vertices[bottom_left * 6] * coloring_info.img.cols);
-            float bottom_left_y_pixels = (float)(vertices[bottom_left * 6 + 1] * coloring_info.img.rows);
-
-            // set of points for both triangles in the box
-            std::vector<double> x_points_1;
-            std::vector<double> y_points_1;
-            std::vector<double> x_points_2;
-            std::vector<double> y_points_2;
-            get_edge_points_box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, edges, x_points_1, y_points_1, x_points_2, y_points_2);
-
-            int basee = (x + (y * x_max)) * 6;
-            bool (*test_left_triangle)(float, float) = [](float x, float y) {return x + y <= 1.0f;};
-            bool (*test_right_triangle)(float, float) = [](float x, float y) {return x + y >= 1.0f;};
-            compute_line_and_update_colors(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.img, coloring_info.saliency_map, coloring_info.use_saliency, &triangle_colors[0][basee], &triangle_colors[1][basee], &triangle_colors[2][basee], num_edge_detection_points, test_left_triangle, true, x_points_1, y_points_1);
-            compute_line_and_update_colors(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.img, coloring_info.saliency_map, coloring_info.use_saliency, &triangle_colors[0][basee + 3], &triangle_colors[1][basee + 3], &triangle_colors[2][basee + 3], num_edge_detection_points, test_right_triangle, false, x_points_2, y_points_2);
+            coloring_info.triangle_errors[box * 2] = (float)squared_errors[0];
+            coloring_info.triangle_errors[box * 2 + 1] = (float)squared_errors[1];
         }
-    }
+    });
 }
 
 //  -------------------------------------------------------------------------------------------------------------
@@ -919,109 +1583,365 @@ void update_quadratic_split_constant_color(const update_coloring_info& coloring_
     float width_triangle_pixels = (float)coloring_info.img.cols / (float)x_max;
     float height_triangle_pixels = (float)coloring_info.img.rows / (float)y_max;
 
-    for (int y = 0; y < y_max; y++)
+    // one task per box (the cost of a box depends a lot on the number of edge pixels in it), balanced with work stealing
+    coloring_pool().parallel_for_stealing(0, x_max * y_max, [&](int box)
     {
-        for (int x = 0; x < x_max; x++)
+        int x = box % x_max;
+        int y = box / x_max;
+
+        // (x_max + 1) becuase the rightmost vertices are already tested in the previous box
+        unsigned int bottom_left = (x_max + 1) * y + x;
+
+        // top left = (0, 0), top right = (0, img.cols - 1), bottom left = (img.rows - 1, 0)
+        float bottom_left_x_pixels = (float)(vertices[bottom_left * 6] * coloring_info.img.cols);
+        float bottom_left_y_pixels = (float)(vertices[bottom_left * 6 + 1] * coloring_info.img.rows);
+
+        // quadratic moments of the edge points of both triangles in the box (one streaming pass, no point lists or gsl buffers)
+        quadratic_moments moments[2];
+        get_edge_moments_box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, edges, moments);
+
+        int basee = (x + (y * x_max)) * 6;
+        triangle_split splits[2];
+        splits[0] = compute_quadratic_split(num_edge_detection_points, moments[0], &triangle_colors[2][basee]);
+        splits[1] = compute_quadratic_split(num_edge_detection_points, moments[1], &triangle_colors[2][basee + 3]);
+
+        // average color at either side of the split curves of both triangles in one pass over the box
+        color_accumulator totals[2][2];
+        accumulate_box_split_colors(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.planar, coloring_info.use_saliency, splits, totals);
+        double squared_errors[2];
+        squared_errors[0] = update_split_colors(splits[0], totals[0], &triangle_colors[0][basee], &triangle_colors[1][basee]);
+        squared_errors[1] = update_split_colors(splits[1], totals[1], &triangle_colors[0][basee + 3], &triangle_colors[1][basee + 3]);
+        if (coloring_info.triangle_errors)
         {
-            // (x_max + 1) becuase the rightmost vertices are already tested in the previous box
-            unsigned int bottom_left = (x_max + 1) * y + x;
+            coloring_info.triangle_errors[box * 2] = (float)squared_errors[0];
+            coloring_info.triangle_errors[box * 2 + 1] = (float)squared_errors[1];
+        }
+    });
+}
 
-            // top left = (0, 0), top right = (0, img.cols - 1), bottom left = (img.rows - 1, 0)
-            float bottom_left_x_pixels = (float)(vertices[bottom_left * 6] * coloring_info.img.cols);
-            float bottom_left_y_pixels = (float)(vertices[bottom_left * 6 + 1] * coloring_info.img.rows);
 
-            // set of points for both triangles in the box
-            std::vector<double> x_points_1;
-            std::vector<double> y_points_1;
-            std::vector<double> x_points_2;
-            std::vector<double> y_points_2;
-            get_edge_points_box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, edges, x_points_1, y_points_1, x_points_2, y_points_2);
+//  -------------------------------------------------------------------------------------------------------------------------
+// | finds the best fit for the datapoints (pixel data) with a nth degree bezier triangle model for all 3 color channels      |
+// | the design matrix only depends on the pixel positions, so it is built and decomposed (svd) once and solved for r, g, b   |
+// | (the same truncated svd solve as gsl_multifit_linear); chisq gets the sum of the squared residuals per channel ([0, 1]) |
+// | with fewer pixels than control points (gsl does not solve those) the ridge normal equations are used instead          |
+//  -------------------------------------------------------------------------------------------------------------------------
+void optimize_nth_bezier_triangle(int n, const std::vector<pixel_info>& pixels, const std::vector<barycentric_coordinates>& bary_coords, float** triangle_colors, int triangle_colors_base, box_scratch& scratch, double chisq[3])
+{
+    int num_data_points = (int)pixels.size();
+    int num_control_points = (n + 1) * (n + 2) / 2;
+    if (num_data_points < num_control_points)
+    {
+        // only the sum over the channels is known (there is no error bound for these fits anyway, see fit_error_bound)
+        double squared_error;
+        fit_triangle_normal_equations(n, pixels, bary_coords, false, triangle_colors, triangle_colors_base, squared_error);
+        for (int color_channel = 0; color_channel < 3; ++color_channel) { chisq[color_channel] = squared_error / 3.0; }
+        return;
+    }
 
-            int basee = (x + (y * x_max)) * 6;
-            bool (*test_left_triangle)(float, float) = [](float x, float y) {return x + y <= 1.0f;};
-            bool (*test_right_triangle)(float, float) = [](float x, float y) {return x + y >= 1.0f;};
-            compute_quadratic_and_update_colors(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.img, coloring_info.saliency_map, coloring_info.use_saliency, &triangle_colors[0][basee], &triangle_colors[1][basee], &triangle_colors[2][basee], num_edge_detection_points, test_left_triangle, true, x_points_1, y_points_1);
-            compute_quadratic_and_update_colors(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.img, coloring_info.saliency_map, coloring_info.use_saliency, &triangle_colors[0][basee + 3], &triangle_colors[1][basee + 3], &triangle_colors[2][basee + 3], num_edge_detection_points, test_right_triangle, false, x_points_2, y_points_2);
+    // views of the needed size into the preallocated scratch buffers
+    scratch.reserve(num_data_points, num_control_points);
+    gsl_matrix_view X = gsl_matrix_submatrix(scratch.X, 0, 0, num_data_points, num_control_points);
+    gsl_vector_view y = gsl_vector_subvector(scratch.y, 0, num_data_points);
+    gsl_vector_view c = gsl_vector_subvector(scratch.c, 0, num_control_points);
+
+    for (int p = 0; p < num_data_points; ++p)
+    {
+        bezier_basis(n, bary_coords[p].s, bary_coords[p].t, bary_coords[p].u, gsl_matrix_ptr(&X.matrix, p, 0));
+    }
+    gsl_multifit_linear_bsvd(&X.matrix, scratch.work);
+
+    for (int color_channel = 0; color_channel < 3; ++color_channel)
+    {
+        for (int p = 0; p < num_data_points; ++p)
+        {
+            gsl_vector_set(&y.vector, p, pixels[p].color[color_channel] / 255.0f);
+        }
+        double rnorm, snorm;
+        gsl_multifit_linear_solve(0.0, &X.matrix, &y.vector, &c.vector, &rnorm, &snorm, scratch.work);
+        chisq[color_channel] = rnorm * rnorm;
+
+        for (int i = 0; i < num_control_points; ++i)
+        {
+            triangle_colors[i][triangle_colors_base + color_channel] = (float)gsl_vector_get(&c.vector, (i));
         }
     }
 }
 
 
-//  ---------------------------------------------------------------------------------------------------------
-// | simple factorial funciton that only accepts number >= 0 and returns the mathematical expression number! |
-//  ---------------------------------------------------------------------------------------------------------
-int fact(int n)
+//  ------------------------------------------------------------------------------------------------------------------------
+// | fits both triangles of a box with the normal equations (see bezier_normal_equations), reading the pixels straight     |
+// | from the planar image: every pixel of the box (samples_per_triangle = 0) or a stratified subset (see box_sampler)     |
+// | writes the control points to triangle_colors, chisq gets the sums of the squared residuals and num_samples the number |
+// | of pixels used per triangle (left, right)                                                                             |
+// | with use_saliency every pixel is weighted with saliency value + bias (chisq is then scaled back to unit weights)       |
+// | single_precision sums the spans with the simd kernels and solves in float (see bezier_kernels.h and                    |
+// | solve_single_precision); returns the number of triangles that needed the double precision fallback                     |
+// | squared_errors gets the weighted squared error per triangle (channels summed, not scaled back, for the error map)      |
+//  ------------------------------------------------------------------------------------------------------------------------
+template <int n>
+int fit_box_normal_equations(const box_rasterizer& box, const planar_color_image& planar, bool use_saliency, bool single_precision, int samples_per_triangle, float** triangle_colors, int triangle_colors_base, double chisq[2][3], double squared_errors[2], int num_samples[2])
 {
-    return (n <= 0) ? 1 : n * fact(n-1);
+    bezier_normal_equations<n> equations[2]; // left triangle, right triangle
+
+    // same barycentric coordinates as convert_to_barycentric
+    auto add_pixel = [&](int i, int j, bool left_triangle, const float color[3])
+    {
+        float x = box.x(i);
+        float y = box.y(j);
+        float weight = (use_saliency) ? planar.plane_row(planar_color_image::weight, box.y0 + j)[box.x0 + i] : 1.0f;
+        if (left_triangle) { equations[0].add(1.0f - y - x, x, y, color, weight); }
+        else
+        {
+            float s = 1.0f - y;
+            float t = 1.0f - x;
+            equations[1].add(s, t, 1.0f - s - t, color, weight);
+        }
+    };
+    if (samples_per_triangle > 0)
+    {
+        box_sampler sampler(box, samples_per_triangle);
+        sampler.for_each_sample([&](int i, int j, bool in_left, bool in_right)
+        {
+            float color[3];
+            color[0] = planar.plane_row(planar_color_image::red, box.y0 + j)[box.x0 + i];
+            color[1] = planar.plane_row(planar_color_image::green, box.y0 + j)[box.x0 + i];
+            color[2] = planar.plane_row(planar_color_image::blue, box.y0 + j)[box.x0 + i];
+            if (in_left) { add_pixel(i, j, true, color); }
+            if (in_right) { add_pixel(i, j, false, color); }
+        });
+    }
+    else if (single_precision)
+    {
+        bezier_span_kernel<n> add_span = active_bezier_span_kernel<n>();
+        box.for_each_span([&](int j, int i_begin, int i_end, bool left_triangle)
+        {
+            int offset = box.x0 + i_begin;
+            bezier_span span;
+            span.left_triangle = left_triangle;
+            span.x0 = box.x(i_begin);
+            span.dx = 1.0f / box.width;
+            span.y = box.y(j);
+            span.r = planar.plane_row(planar_color_image::red, box.y0 + j) + offset;
+            span.g = planar.plane_row(planar_color_image::green, box.y0 + j) + offset;
+            span.b = planar.plane_row(planar_color_image::blue, box.y0 + j) + offset;
+            span.w = (use_saliency) ? planar.plane_row(planar_color_image::weight, box.y0 + j) + offset : nullptr;
+            span.count = i_end - i_begin;
+            add_span(span, equations[(left_triangle) ? 0 : 1]);
+        });
+    }
+    else { add_box_pixels(box, planar, use_saliency, equations); }
+
+    int fallbacks = 0;
+    for (int side = 0; side < 2; ++side)
+    {
+        double control_points[3][bezier_normal_equations<n>::num_params];
+        if (!single_precision) { equations[side].solve(control_points, chisq[side]); }
+        else if (!equations[side].solve_single_precision(control_points, chisq[side])) { ++fallbacks; }
+        squared_errors[side] = chisq[side][0] + chisq[side][1] + chisq[side][2];
+        for (int i = 0; i < bezier_normal_equations<n>::num_params; ++i)
+        {
+            for (int c = 0; c < 3; ++c) { triangle_colors[i][triangle_colors_base + side * 3 + c] = (float)control_points[c][i]; }
+        }
+        if (use_saliency && equations[side].weight_sum > 0.0)
+        {
+            for (int c = 0; c < 3; ++c) { chisq[side][c] *= equations[side].count / equations[side].weight_sum; }
+        }
+        num_samples[side] = equations[side].count;
+    }
+    return fallbacks;
 }
-//  ----------------------------------------------------------------------------------------------------------------------
-// | finds the best fit for the datapoints (pixel data) with a nth degree bezier triangle model for a given color channel |
-//  ----------------------------------------------------------------------------------------------------------------------
-void optimize_nth_bezier_triangle(int n, int color_channel, std::vector<pixel_info>& pixels, std::vector<barycentric_coordinates>& bary_coords, float** triangle_colors, int triangle_colors_base)
+int fit_box_normal_equations(int n, const box_rasterizer& box, const planar_color_image& planar, bool use_saliency, bool single_precision, int samples_per_triangle, float** triangle_colors, int triangle_colors_base, double chisq[2][3], double squared_errors[2], int num_samples[2])
 {
-    int num_data_points = (int)pixels.size();
-    double chisq;
-    gsl_matrix *X, *cov;
-    gsl_vector *y, *c;
+    switch (n)
+    {
+        case 1: return fit_box_normal_equations<1>(box, planar, use_saliency, single_precision, samples_per_triangle, triangle_colors, triangle_colors_base, chisq, squared_errors, num_samples);
+        case 2: return fit_box_normal_equations<2>(box, planar, use_saliency, single_precision, samples_per_triangle, triangle_colors, triangle_colors_base, chisq, squared_errors, num_samples);
+        case 3: return fit_box_normal_equations<3>(box, planar, use_saliency, single_precision, samples_per_triangle, triangle_colors, triangle_colors_base, chisq, squared_errors, num_samples);
+        case 4: return fit_box_normal_equations<4>(box, planar, use_saliency, single_precision, samples_per_triangle, triangle_colors, triangle_colors_base, chisq, squared_errors, num_samples);
+    }
+    return 0;
+}
 
+//  ---------------------------------------------------------------------------------------------------------------------------
+// | batched version of the cached projection solver of update_general_interpolation (without sampling)                       |
+// | the boxes are grouped by pixel layout (a group shares the projection operators, see bezier_projection_cache) and the     |
+// | colors of a tile of boxes of one group are stacked in a matrix Y (one row per box and color channel), so the control     |
+// | points of the whole tile are one matrix product C = Y P^T (cblas_dgemm) instead of a matrix vector product per triangle  |
+// | the tiles are sized so their Y fits in the L2 cache (bezier_batch_cache_bytes) and are run in parallel                   |
+//  ---------------------------------------------------------------------------------------------------------------------------
+void update_general_interpolation_batched(int n, const update_coloring_info& coloring_info, const float vertices[], float** triangle_colors)
+{
+    int x_max = coloring_info.num_triangles_x;
+    int y_max = coloring_info.num_triangles_y;
+    float width_triangle_pixels = (float)coloring_info.img.cols / (float)x_max;
+    float height_triangle_pixels = (float)coloring_info.img.rows / (float)y_max;
     int num_control_points = (n + 1) * (n + 2) / 2;
-    float numerator = fact(n);
-
-    X = gsl_matrix_alloc(num_data_points, num_control_points);
-    y = gsl_vector_alloc(num_data_points);
-    c = gsl_vector_alloc(num_control_points);
-    cov = gsl_matrix_alloc(num_control_points, num_control_points);
+    const planar_color_image& planar = coloring_info.planar;
 
-    for (int p = 0; p < num_data_points; ++p)
+    auto box_at = [&](int box)
+    {
+        // (x_max + 1) becuase the rightmost vertices are already tested in the previous box
+        unsigned int bottom_left = (x_max + 1) * (box / x_max) + box % x_max;
+        float bottom_left_x_pixels = (float)(vertices[bottom_left * 6] * coloring_info.img.cols);
+        float bottom_left_y_pixels = (float)(vertices[bottom_left * 6 + 1] * coloring_info.img.rows);
+        return box_rasterizer(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, planar.cols, planar.rows);
+    };
+
+    // group the boxes by their size in pixels (only the boxes clipped by the image border differ from the rest)
+    std::map<std::pair<int, int>, std::vector<int>> layouts;
+    for (int box = 0; box < x_max * y_max; ++box)
     {
-        float s = bary_coords[p].s;
-        float t = bary_coords[p].t;
-        float u = bary_coords[p].u;
+        box_rasterizer rasterizer = box_at(box);
+        layouts[{rasterizer.nx, rasterizer.ny}].push_back(box);
+    }
 
-        int index = 0;
-        for (int i = 0; i <= n; ++i)
+    struct batch_tile
+    {
+        std::shared_ptr<const bezier_projection> projections[2]; // left triangle, right triangle
+        const int* boxes;
+        int num_boxes;
+    };
+    std::vector<batch_tile> tiles;
+    box_scratch& scratch = thread_scratch();
+    for (const auto& layout : layouts)
+    {
+        // projection operators of the layout, made from the pixels of its first box if they are not cached yet
+        box_rasterizer first = box_at(layout.second[0]);
+        scratch.pixels[0].clear();
+        scratch.pixels[1].clear();
+        get_pixels_in_box(first.x0, first.y0, width_triangle_pixels, height_triangle_pixels, planar, scratch.pixels[0], scratch.pixels[1]);
+        convert_to_barycentric(scratch.pixels[0], true, scratch.bary_coords[0]);
+        convert_to_barycentric(scratch.pixels[1], false, scratch.bary_coords[1]);
+        batch_tile tile;
+        tile.projections[0] = bezier_projections().get({n, width_triangle_pixels, height_triangle_pixels, true, first.nx, first.ny}, scratch.bary_coords[0]);
+        tile.projections[1] = bezier_projections().get({n, width_triangle_pixels, height_triangle_pixels, false, first.nx, first.ny}, scratch.bary_coords[1]);
+
+        size_t box_bytes = sizeof(double) * 3 * (size_t)(tile.projections[0]->num_pixels + tile.projections[1]->num_pixels);
+        int boxes_per_tile = (int)std::max(bezier_batch_cache_bytes / std::max(box_bytes, (size_t)1), (size_t)1);
+        for (int begin = 0; begin < (int)layout.second.size(); begin += boxes_per_tile)
         {
-            for (int j = 0; i+j <= n; ++j)
-            {
-                int k = n - i - j;
-                float multiplier = (numerator / (float)(fact(i) * fact(j) * fact(k)));
-                gsl_matrix_set(X, p, index, multiplier * std::pow(s, i) * std::pow(t, j) * std::pow(u, k));
-                ++index;
-            }
+            tile.boxes = &layout.second[begin];
+            tile.num_boxes = std::min(boxes_per_tile, (int)layout.second.size() - begin);
+            tiles.push_back(tile);
         }
-        gsl_vector_set(y, p, pixels[p].color[color_channel] / 255.0f);
     }
 
-    gsl_multifit_linear_workspace* work = gsl_multifit_linear_alloc(num_data_points, num_control_points);
-    gsl_multifit_linear(X, y, c, cov, &chisq, work);
-
-    for (int i = 0; i < num_control_points; ++i)
+    coloring_pool().parallel_for(0, (int)tiles.size(), [&](int t)
     {
-        triangle_colors[i][triangle_colors_base + color_channel] = (float)gsl_vector_get(c, (i));
-    }
+        const batch_tile& tile = tiles[t];
+        box_scratch& scratch = thread_scratch();
+        int num_pixels[2] = {tile.projections[0]->num_pixels, tile.projections[1]->num_pixels};
+        for (int side = 0; side < 2; ++side)
+        {
+            scratch.batch_colors[side].resize((size_t)3 * tile.num_boxes * num_pixels[side]);
+        }
+        scratch.batch_control_points.resize((size_t)3 * tile.num_boxes * num_control_points);
+        scratch.batch_yty.assign((size_t)2 * tile.num_boxes, 0.0);
 
-    gsl_multifit_linear_free(work);
-    gsl_matrix_free(X);
-    gsl_vector_free(y);
-    gsl_vector_free(c);
-    gsl_matrix_free(cov);
-}
+        // Y: row (b * 3 + channel) has the colors of the pixels of box b in the order of get_pixels_in_box
+        for (int b = 0; b < tile.num_boxes; ++b)
+        {
+            box_rasterizer box = box_at(tile.boxes[b]);
+            int pixel[2] = {0, 0};
+            double* yty = &scratch.batch_yty[(size_t)b * 2];
+            box.for_each_span([&](int j, int i_begin, int i_end, bool left_triangle)
+            {
+                int side = (left_triangle) ? 0 : 1;
+                const float* rows[3] = {planar.plane_row(planar_color_image::red, box.y0 + j) + box.x0, planar.plane_row(planar_color_image::green, box.y0 + j) + box.x0, planar.plane_row(planar_color_image::blue, box.y0 + j) + box.x0};
+                for (int c = 0; c < 3; ++c)
+                {
+                    double* colors = &scratch.batch_colors[side][(size_t)(b * 3 + c) * num_pixels[side] + pixel[side]];
+                    for (int i = i_begin; i < i_end; ++i) { colors[i - i_begin] = rows[c][i] / 255.0f; }
+                    if (coloring_info.triangle_errors)
+                    {
+                        for (int i = i_begin; i < i_end; ++i) { yty[side] += colors[i - i_begin] * colors[i - i_begin]; }
+                    }
+                }
+                pixel[side] += i_end - i_begin;
+            });
+        }
+
+        for (int side = 0; side < 2; ++side)
+        {
+            // C (3 * num_boxes x num_control_points) = Y (3 * num_boxes x num_pixels) * P^T (P: num_control_points x num_pixels)
+            int lead = std::max(num_pixels[side], 1);
+            cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, 3 * tile.num_boxes, num_control_points, num_pixels[side],
+                        1.0, scratch.batch_colors[side].data(), lead, tile.projections[side]->pinv.data(), lead,
+                        0.0, scratch.batch_control_points.data(), num_control_points);
 
+            for (int b = 0; b < tile.num_boxes; ++b)
+            {
+                int basee = tile.boxes[b] * 6 + side * 3;
+                const double* control_points = &scratch.batch_control_points[(size_t)b * 3 * num_control_points];
+                for (int c = 0; c < 3; ++c)
+                {
+                    for (int i = 0; i < num_control_points; ++i) { triangle_colors[i][basee + c] = (float)control_points[c * num_control_points + i]; }
+                }
+                if (coloring_info.triangle_errors)
+                {
+                    double yty = scratch.batch_yty[(size_t)b * 2 + side];
+                    coloring_info.triangle_errors[tile.boxes[b] * 2 + side] = (float)tile.projections[side]->squared_error(yty, control_points, control_points + num_control_points, control_points + 2 * num_control_points);
+                }
+            }
+        }
+    });
+}
 
 //  --------------------------------------------------------------------------------------------------------
 // | coloring method: nonlinear interpolation                                                               |
 // | for each triangle, approximate the pixels within that triangle with a nth degree bezier triangle       |
 // | n=1 -> bilinear interpolation; n=2 biquadratic interpolation, etc                                      |
+// | with sampling enabled only a stratified subset of the pixels is fitted (see update_sampled_constant_colors) |
+// | and the error bound of every fit is added to report                                                    |
+// | the projection solver reuses one pseudo inverse for all boxes with the same pixel layout (see bezier.h) |
+// | the normal equations solver never stores the pixels of a triangle (see fit_box_normal_equations)       |
+// | the batched solver fits whole tiles of boxes with one matrix product (see update_general_interpolation_batched) |
+// | (the projection solvers need the same pixel layout in every box, with sampling they use the svd per triangle) |
+// | with use_saliency the svd and projection solvers fit through the weighted normal equations (the weights differ |
+// | per box, so there is no shared projection), see effective_bezier_solver; the ui shows the solver that ran      |
+// | the single precision solver is the normal equations solver in float; precision_report gets how many        |
+// | triangles fell back to double                                                                                |
+// | the squared error per triangle (coloring_info.triangle_errors) comes from the sums the solvers already have |
 //  --------------------------------------------------------------------------------------------------------
-void update_general_interpolation(int n, const update_coloring_info& coloring_info, const float vertices[], float** triangle_colors)
+void update_general_interpolation(int n, const update_coloring_info& coloring_info, const float vertices[], float** triangle_colors, sampling_report& report, single_precision_report& precision_report)
 {
     int x_max = coloring_info.num_triangles_x;
     int y_max = coloring_info.num_triangles_y;
     float width_triangle_pixels = (float)coloring_info.img.cols / (float)x_max;
     float height_triangle_pixels = (float)coloring_info.img.rows / (float)y_max;
+    const sampling_settings& sampling = coloring_info.sampling;
+    int num_control_points = (n + 1) * (n + 2) / 2;
+    // sampled pixels are at different box positions in every box, so only the full boxes can share a projection operator
+    bezier_solver_type solver = effective_bezier_solver(coloring_info.bezier_solver, coloring_info.use_saliency, sampling.enabled);
+    bool use_projection = solver == bezier_solver_projection;
+    bool single_precision = solver == bezier_solver_single_precision;
+    bool use_normal_equations = solver == bezier_solver_normal_equations || single_precision;
+
+    // per triangle sampling results, combined in the report after the parallel loop
+    std::vector<int> num_samples((sampling.enabled) ? x_max * y_max * 2 : 0);
+    std::vector<int> num_pixels(num_samples.size());
+    std::vector<double> errors(num_samples.size());
+    std::vector<int> fallbacks(y_max, 0); // per row of boxes
+    precision_report = single_precision_report();
+
+    if (solver == bezier_solver_batched)
+    {
+        update_general_interpolation_batched(n, coloring_info, vertices, triangle_colors);
+        report = sampling_report();
+        return;
+    }
 
-    for (int y = 0; y < y_max; y++)
+    coloring_pool().parallel_for(0, y_max, [&](int y)
     {
+        // per box buffers borrowed from the scratch arena of the thread that runs this row, sized for the largest box (a box has ceil(w) x ceil(h) pixels)
+        box_scratch& scratch = thread_scratch();
+        if (!use_normal_equations) { scratch.reserve((size_t)std::ceil(width_triangle_pixels) * (size_t)std::ceil(height_triangle_pixels), (n + 1) * (n + 2) / 2); }
+        std::vector<pixel_info>& triangle_1 = scratch.pixels[0];
+        std::vector<pixel_info>& triangle_2 = scratch.pixels[1];
+        std::vector<barycentric_coordinates>& bary_1 = scratch.bary_coords[0];
+        std::vector<barycentric_coordinates>& bary_2 = scratch.bary_coords[1];
+
         for (int x = 0; x < x_max; x++)
         {
             // (x_max + 1) becuase the rightmost vertices are already tested in the previous box
@@ -1031,31 +1951,375 @@ void update_general_interpolation(int n, const update_coloring_info& coloring_in
             float bottom_left_x_pixels = (float)(vertices[bottom_left * 6] * coloring_info.img.cols);
             float bottom_left_y_pixels = (float)(vertices[bottom_left * 6 + 1] * coloring_info.img.rows);
 
-            // function to test for a box which triangle is the bottom left one or the top right one
-            bool (*test_left_triangle)(float, float) = [](float x, float y) {return x + y <= 1.0f;};
-            bool (*test_right_triangle)(float, float) = [](float x, float y) {return x + y >= 1.0f;};
+            box_rasterizer box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.planar.cols, coloring_info.planar.rows);
+            int pixel_counts[2] = {0, 0};
+            if (sampling.enabled) { count_triangle_pixels(box, pixel_counts); }
 
-            // get the sample points for both triangles
-            std::vector<pixel_info> triangle_1;
-            std::vector<pixel_info> triangle_2;
-            get_pixels_in_triangle(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.img, coloring_info.saliency_map, test_left_triangle, triangle_1);
-            get_pixels_in_triangle(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.img, coloring_info.saliency_map, test_right_triangle, triangle_2);
+            int basee = (x + (y * x_max)) * 6;
+            // at least 2 samples per control point, so the sampled fits stay overdetermined after the split of the box in triangles
+            int samples = std::max(sampling.target_samples, 2 * num_control_points);
+            double chisq[2][3];
+            int box_samples[2] = {0, 0};
+            double box_errors[2] = {NAN, NAN};
+            double squared_errors[2] = {NAN, NAN};
+            int box_fallbacks = 0;
+            // a second pass (with more samples) is only done when the error bound of the first one is too big
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                if (use_normal_equations)
+                {
+                    // the pixels go straight from the planar image into the normal equations
+                    box_fallbacks = fit_box_normal_equations(n, box, coloring_info.planar, coloring_info.use_saliency, single_precision, (sampling.enabled) ? samples : 0, triangle_colors, basee, chisq, squared_errors, box_samples);
+                }
+                else
+                {
+                    // get the sample points for both triangles (in one pass over the box)
+                    triangle_1.clear();
+                    triangle_2.clear();
+                    if (sampling.enabled) { sample_pixels_in_box(box, coloring_info.planar, samples, triangle_1, triangle_2); }
+                    else { get_pixels_in_box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.planar, triangle_1, triangle_2); }
+                    box_samples[0] = (int)triangle_1.size();
+                    box_samples[1] = (int)triangle_2.size();
+
+                    // convert the points to the barycentric coordinates
+                    convert_to_barycentric(triangle_1, true, bary_1);
+                    convert_to_barycentric(triangle_2, false, bary_2);
+
+                    if (use_projection)
+                    {
+                        squared_errors[0] = bezier_projections().get({n, width_triangle_pixels, height_triangle_pixels, true, box.nx, box.ny}, bary_1)->apply(triangle_1, triangle_colors, basee);
+                        squared_errors[1] = bezier_projections().get({n, width_triangle_pixels, height_triangle_pixels, false, box.nx, box.ny}, bary_2)->apply(triangle_2, triangle_colors, basee + 3);
+                        break;
+                    }
+
+                    // find bast fit parameters (for both triangles and their corresponding color channels) and save the value to the appropriate uniform buffer
+                    optimize_nth_bezier_triangle(n, triangle_1, bary_1, triangle_colors, basee, scratch, chisq[0]);
+                    optimize_nth_bezier_triangle(n, triangle_2, bary_2, triangle_colors, basee + 3, scratch, chisq[1]);
+                    squared_errors[0] = chisq[0][0] + chisq[0][1] + chisq[0][2];
+                    squared_errors[1] = chisq[1][0] + chisq[1][1] + chisq[1][2];
+                }
+
+                if (!sampling.enabled) { break; }
+                box_errors[0] = fit_error_bound(chisq[0], box_samples[0], num_control_points, pixel_counts[0]);
+                box_errors[1] = fit_error_bound(chisq[1], box_samples[1], num_control_points, pixel_counts[1]);
+                if (!sampling.use_error_bound) { break; }
+                int needed = std::max(samples_for_error_bound(box_samples[0], box_errors[0], sampling.error_bound),
+                                      samples_for_error_bound(box_samples[1], box_errors[1], sampling.error_bound));
+                if (needed <= std::max(box_samples[0], box_samples[1])) { break; }
+                samples = needed;
+            }
+
+            fallbacks[y] += box_fallbacks;
+            if (coloring_info.triangle_errors)
+            {
+                for (int side = 0; side < 2; ++side)
+                {
+                    // a sampled fit only has the error of its samples, scaled up to all pixels of the triangle
+                    double scale = (sampling.enabled && box_samples[side] > 0) ? (double)pixel_counts[side] / box_samples[side] : 1.0;
+                    coloring_info.triangle_errors[(x + (y * x_max)) * 2 + side] = (float)(squared_errors[side] * scale);
+                }
+            }
+            if (sampling.enabled)
+            {
+                int triangle = (x + (y * x_max)) * 2;
+                num_samples[triangle] = box_samples[0];
+                num_samples[triangle + 1] = box_samples[1];
+                num_pixels[triangle] = pixel_counts[0];
+                num_pixels[triangle + 1] = pixel_counts[1];
+                errors[triangle] = box_errors[0];
+                errors[triangle + 1] = box_errors[1];
+            }
+        }
+    });
+
+    report = sampling_report();
+    for (int i = 0; i < (int)errors.size(); ++i)
+    {
+        report.add_triangle(num_samples[i], num_pixels[i], errors[i]);
+    }
+    if (single_precision)
+    {
+        precision_report.num_fits = x_max * y_max * 2;
+        precision_report.num_fallbacks = std::accumulate(fallbacks.begin(), fallbacks.end(), 0);
+    }
+}
+
+//  ------------------------------------------------------------------------------------------------------------------------
+// | fits the pixels of one triangle with a degree n bezier triangle (normal equations, see bezier_normal_equations) and   |
+// | writes the control points to triangle_colors; returns the rms error of the fit (largest over the channels, [0, 1])     |
+// | with use_saliency the pixels are weighted with their saliency value and the rms error is the weighted one               |
+// | squared_error gets the (weighted) squared error of the fit, summed over the channels                                   |
+//  ------------------------------------------------------------------------------------------------------------------------
+template <int n>
+double solve_triangle_normal_equations(const bezier_normal_equations<n>& equations, float** triangle_colors, int triangle_colors_base, double& squared_error)
+{
+    double control_points[3][bezier_normal_equations<n>::num_params];
+    double chisq[3];
+    equations.solve(control_points, chisq);
+    for (int i = 0; i < bezier_normal_equations<n>::num_params; ++i)
+    {
+        for (int c = 0; c < 3; ++c) { triangle_colors[i][triangle_colors_base + c] = (float)control_points[c][i]; }
+    }
+    squared_error = chisq[0] + chisq[1] + chisq[2];
+    if (equations.count == 0 || !(equations.weight_sum > 0.0)) { return 0.0; }
+    return std::sqrt(std::max(chisq[0], std::max(chisq[1], chisq[2])) / equations.weight_sum);
+}
+template <int n>
+void add_triangle_pixels(const std::vector<pixel_info>& pixels, const std::vector<barycentric_coordinates>& bary_coords, bool use_saliency, bezier_normal_equations<n>& equations)
+{
+    for (int p = 0; p < (int)pixels.size(); ++p)
+    {
+        equations.add(bary_coords[p].s, bary_coords[p].t, bary_coords[p].u, pixels[p].color, (use_saliency) ? pixels[p].saliency_value : 1.0f);
+    }
+}
+template <int n>
+double fit_triangle_normal_equations(const std::vector<pixel_info>& pixels, const std::vector<barycentric_coordinates>& bary_coords, bool use_saliency, float** triangle_colors, int triangle_colors_base, double& squared_error)
+{
+    bezier_normal_equations<n> equations;
+    add_triangle_pixels(pixels, bary_coords, use_saliency, equations);
+    return solve_triangle_normal_equations(equations, triangle_colors, triangle_colors_base, squared_error);
+}
+double fit_triangle_normal_equations(int n, const std::vector<pixel_info>& pixels, const std::vector<barycentric_coordinates>& bary_coords, bool use_saliency, float** triangle_colors, int triangle_colors_base, double& squared_error)
+{
+    switch (n)
+    {
+        case 0: return fit_triangle_normal_equations<0>(pixels, bary_coords, use_saliency, triangle_colors, triangle_colors_base, squared_error);
+        case 1: return fit_triangle_normal_equations<1>(pixels, bary_coords, use_saliency, triangle_colors, triangle_colors_base, squared_error);
+        case 2: return fit_triangle_normal_equations<2>(pixels, bary_coords, use_saliency, triangle_colors, triangle_colors_base, squared_error);
+        case 3: return fit_triangle_normal_equations<3>(pixels, bary_coords, use_saliency, triangle_colors, triangle_colors_base, squared_error);
+        default: return fit_triangle_normal_equations<4>(pixels, bary_coords, use_saliency, triangle_colors, triangle_colors_base, squared_error);
+    }
+}
+// same as fit_triangle_normal_equations for degree n <= bezier_max_degree, from the normal equations of the highest degree (see lower_degree)
+double fit_triangle_lower_degree(int n, const bezier_normal_equations<bezier_max_degree>& equations, float** triangle_colors, int triangle_colors_base, double& squared_error)
+{
+    switch (n)
+    {
+        case 0: return solve_triangle_normal_equations(equations.lower_degree<0>(), triangle_colors, triangle_colors_base, squared_error);
+        case 1: return solve_triangle_normal_equations(equations.lower_degree<1>(), triangle_colors, triangle_colors_base, squared_error);
+        case 2: return solve_triangle_normal_equations(equations.lower_degree<2>(), triangle_colors, triangle_colors_base, squared_error);
+        case 3: return solve_triangle_normal_equations(equations.lower_degree<3>(), triangle_colors, triangle_colors_base, squared_error);
+        default: return solve_triangle_normal_equations(equations, triangle_colors, triangle_colors_base, squared_error);
+    }
+}
+
+//  ---------------------------------------------------------------------------------------------------------------------------
+// | coloring method: adaptive interpolation                                                                                  |
+// | every triangle is fitted with a bezier triangle of degree 0 (constant), 1, 2, ... until the rms error of the fit is at   |
+// | most max_error or the degree is bezier_max_degree; degree_counts gets the number of triangles per degree                 |
+// | the shader evaluates each triangle at its own degree: below bezier_max_degree the last control point (last uniform       |
+// | buffer) is not used, so it holds adaptive_degree_marker and the degree instead (see adaptive_degree)                     |
+// | the pixels are only added once (streamed from the planar image, see add_box_pixels), to the normal equations of the     |
+// | highest degree; the lower degrees are derived from those (see bezier_normal_equations::lower_degree), so trying every    |
+// | degree costs 5 small solves instead of 5 fits                                                                            |
+//  ---------------------------------------------------------------------------------------------------------------------------
+void update_adaptive_interpolation(const update_coloring_info& coloring_info, const float vertices[], float max_error, float** triangle_colors, int degree_counts[])
+{
+    int x_max = coloring_info.num_triangles_x;
+    int y_max = coloring_info.num_triangles_y;
+    float width_triangle_pixels = (float)coloring_info.img.cols / (float)x_max;
+    float height_triangle_pixels = (float)coloring_info.img.rows / (float)y_max;
+
+    coloring_pool().parallel_for(0, y_max, [&](int y)
+    {
+        for (int x = 0; x < x_max; x++)
+        {
+            // (x_max + 1) becuase the rightmost vertices are already tested in the previous box
+            unsigned int bottom_left = (x_max + 1) * y + x;
+
+            // top left = (0, 0), top right = (0, img.cols - 1), bottom left = (img.rows - 1, 0)
+            float bottom_left_x_pixels = (float)(vertices[bottom_left * 6] * coloring_info.img.cols);
+            float bottom_left_y_pixels = (float)(vertices[bottom_left * 6 + 1] * coloring_info.img.rows);
 
-            // convert the points to the barycentric coordinates (function in struct??)
-            std::vector<barycentric_coordinates> bary_1 = convert_to_barycentric(triangle_1, true);
-            std::vector<barycentric_coordinates> bary_2 = convert_to_barycentric(triangle_2, false);
+            // the pixels of both triangles go straight from the planar image into the normal equations of the highest degree
+            box_rasterizer box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, coloring_info.planar.cols, coloring_info.planar.rows);
+            bezier_normal_equations<bezier_max_degree> equations[2];
+            add_box_pixels(box, coloring_info.planar, coloring_info.use_saliency, equations);
 
-            // find bast fit parameters (for both triangles and their corresponding color channels) and save the value to the appropriate uniform buffer
             int basee = (x + (y * x_max)) * 6;
-            optimize_nth_bezier_triangle(n, 0, triangle_1, bary_1, triangle_colors, basee);
-            optimize_nth_bezier_triangle(n, 1, triangle_1, bary_1, triangle_colors, basee);
-            optimize_nth_bezier_triangle(n, 2, triangle_1, bary_1, triangle_colors, basee);
-            optimize_nth_bezier_triangle(n, 0, triangle_2, bary_2, triangle_colors, basee + 3);
-            optimize_nth_bezier_triangle(n, 1, triangle_2, bary_2, triangle_colors, basee + 3);
-            optimize_nth_bezier_triangle(n, 2, triangle_2, bary_2, triangle_colors, basee + 3);
+            for (int side = 0; side < 2; ++side)
+            {
+                int degree = 0;
+                double squared_error;
+                while (fit_triangle_lower_degree(degree, equations[side], triangle_colors, basee + side * 3, squared_error) > max_error && degree < bezier_max_degree)
+                {
+                    ++degree;
+                }
+                if (degree < bezier_max_degree)
+                {
+                    triangle_colors[num_uniform_buffers - 1][basee + side * 3] = adaptive_degree_marker;
+                    triangle_colors[num_uniform_buffers - 1][basee + side * 3 + 1] = (float)degree;
+                }
+                if (coloring_info.triangle_errors) { coloring_info.triangle_errors[(x + (y * x_max)) * 2 + side] = (float)squared_error; }
+            }
+        }
+    });
+
+    std::fill(degree_counts, degree_counts + bezier_max_degree + 1, 0);
+    for (int triangle = 0; triangle < x_max * y_max * 2; ++triangle)
+    {
+        ++degree_counts[adaptive_degree(triangle_colors, triangle)];
+    }
+}
+// degree of a triangle of the adaptive interpolation (see update_adaptive_interpolation)
+int adaptive_degree(float** triangle_colors, int triangle)
+{
+    const float* last_control_point = &triangle_colors[num_uniform_buffers - 1][triangle * 3];
+    return (last_control_point[0] <= adaptive_degree_marker) ? (int)last_control_point[1] : bezier_max_degree;
+}
+
+//  ----------------------------------------------------------------------------------------------------------------------------
+// | error map: mixes a heat color (blue = no error, green, red = error * error_scale of 1) into the colors of every triangle  |
+// | that has an error estimate; the bernstein polynomials sum to 1, so mixing every control point of a bezier triangle mixes  |
+// | its whole surface and the error needs no uniform buffer of its own; bilinear interpolation (no opt) has no per triangle    |
+// | colors, so its vertex colors become the control points of degree 1 bezier triangles (which the shader then evaluates)      |
+//  ----------------------------------------------------------------------------------------------------------------------------
+void mix_error_map(int mode, int num_triangles_x, int num_triangles_y, const float triangle_errors[], float error_scale, const float vertex_colors[], float** triangle_colors)
+{
+    int x_max = num_triangles_x;
+    for (int triangle = 0; triangle < num_triangles_x * num_triangles_y * 2; ++triangle)
+    {
+        int base = triangle * 3;
+        int num_colors = 1; // uniform buffers with a color of this triangle
+        switch (mode)
+        {
+            case 2:
+            {
+                // same vertices (and control point order u, t, s) as update_vertex_colors
+                int box = triangle / 2;
+                unsigned int bottom_left = (x_max + 1) * (box / x_max) + box % x_max;
+                unsigned int corners[2][3] = {{bottom_left + x_max + 1, bottom_left + 1, bottom_left},
+                                              {bottom_left + x_max + 2, bottom_left + x_max + 1, bottom_left + 1}};
+                for (int k = 0; k < 3; ++k)
+                {
+                    for (int c = 0; c < 3; ++c) { triangle_colors[k][base + c] = vertex_colors[corners[triangle % 2][k] * 3 + c]; }
+                }
+                num_colors = 3;
+                break;
+            }
+            case 3: case 4: num_colors = 2; break; // the third buffer has the coefficients of the split
+            case 5: case 6: case 7: case 8: num_colors = (mode - 3) * (mode - 2) / 2; break; // degree mode - 4
+            case 9:
+            {
+                int n = adaptive_degree(triangle_colors, triangle);
+                num_colors = (n + 1) * (n + 2) / 2;
+                break;
+            }
+        }
+        if (std::isnan(triangle_errors[triangle])) { continue; }
+
+        float heat = std::min(std::max(triangle_errors[triangle] * error_scale, 0.0f), 1.0f);
+        float heat_color[3] = {heat, 1.0f - std::abs(2.0f * heat - 1.0f), 1.0f - heat};
+        for (int i = 0; i < num_colors; ++i)
+        {
+            for (int c = 0; c < 3; ++c) { triangle_colors[i][base + c] = 0.4f * triangle_colors[i][base + c] + 0.6f * heat_color[c]; }
+        }
+    }
+}
 
+//  ----------------------------------------------------------------------------------------------------------------------------
+// | coloring method: global nonlinear interpolation (the interpolation (opt) modes with global fit)                           |
+// | all triangles are fitted at once with the control points on the edges shared by the neighbouring triangles (see          |
+// | bezier_lattice.h), so the colors are continuous over the whole grid; every box only adds X^T y of its two triangles,      |
+// | X^T X comes from the design of its pixel layout; the conjugate gradient starts at the per triangle fits                  |
+// | with use_saliency the pixels are weighted, then every triangle also adds its own X^T W X (same pass over the pixels)     |
+// | (always uses all pixels, without sampling)                                                                               |
+//  ----------------------------------------------------------------------------------------------------------------------------
+void update_global_interpolation(int n, const update_coloring_info& coloring_info, const float vertices[], float** triangle_colors, global_fit_report& report)
+{
+    int x_max = coloring_info.num_triangles_x;
+    int y_max = coloring_info.num_triangles_y;
+    float width_triangle_pixels = (float)coloring_info.img.cols / (float)x_max;
+    float height_triangle_pixels = (float)coloring_info.img.rows / (float)y_max;
+    int num_control_points = (n + 1) * (n + 2) / 2;
+    const planar_color_image& planar = coloring_info.planar;
+
+    auto box_at = [&](int box)
+    {
+        // (x_max + 1) becuase the rightmost vertices are already tested in the previous box
+        unsigned int bottom_left = (x_max + 1) * (box / x_max) + box % x_max;
+        float bottom_left_x_pixels = (float)(vertices[bottom_left * 6] * coloring_info.img.cols);
+        float bottom_left_y_pixels = (float)(vertices[bottom_left * 6 + 1] * coloring_info.img.rows);
+        return box_rasterizer(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, planar.cols, planar.rows);
+    };
+
+    // one design (basis and X^T X) per pixel layout and triangle side, made from the pixels of the first box with that layout
+    bezier_lattice_system system;
+    system.reset(n, x_max, y_max, coloring_info.use_saliency);
+    std::map<std::pair<int, int>, int> layouts;
+    std::vector<std::unique_ptr<bezier_design>> designs;
+    box_scratch& scratch = thread_scratch();
+    for (int box = 0; box < x_max * y_max; ++box)
+    {
+        box_rasterizer rasterizer = box_at(box);
+        auto layout = layouts.find({rasterizer.nx, rasterizer.ny});
+        if (layout == layouts.end())
+        {
+            scratch.pixels[0].clear();
+            scratch.pixels[1].clear();
+            get_pixels_in_box(rasterizer.x0, rasterizer.y0, width_triangle_pixels, height_triangle_pixels, planar, scratch.pixels[0], scratch.pixels[1]);
+            convert_to_barycentric(scratch.pixels[0], true, scratch.bary_coords[0]);
+            convert_to_barycentric(scratch.pixels[1], false, scratch.bary_coords[1]);
+            designs.push_back(std::make_unique<bezier_design>(n, scratch.bary_coords[0]));
+            designs.push_back(std::make_unique<bezier_design>(n, scratch.bary_coords[1]));
+            layout = layouts.insert({{rasterizer.nx, rasterizer.ny}, (int)designs.size() - 2}).first;
         }
+        system.box_designs[2 * box] = designs[layout->second].get();
+        system.box_designs[2 * box + 1] = designs[layout->second + 1].get();
     }
+
+    // X^T W y (and X^T W X) of every triangle (pixels in the order of get_pixels_in_box, the same as the rows of the basis)
+    coloring_pool().parallel_for(0, x_max * y_max, [&](int box)
+    {
+        box_rasterizer rasterizer = box_at(box);
+        int pixel[2] = {0, 0};
+        rasterizer.for_each_span([&](int j, int i_begin, int i_end, bool left_triangle)
+        {
+            int side = (left_triangle) ? 0 : 1;
+            const bezier_design& design = *system.box_designs[2 * box + side];
+            double* rhs = &system.triangle_rhs[(size_t)(2 * box + side) * num_control_points * 3];
+            const float* rows[3] = {planar.plane_row(planar_color_image::red, rasterizer.y0 + j) + rasterizer.x0, planar.plane_row(planar_color_image::green, rasterizer.y0 + j) + rasterizer.x0, planar.plane_row(planar_color_image::blue, rasterizer.y0 + j) + rasterizer.x0};
+            const float* weight_row = (coloring_info.use_saliency) ? planar.plane_row(planar_color_image::weight, rasterizer.y0 + j) + rasterizer.x0 : nullptr;
+            double* gram = (weight_row) ? system.weighted_gram(2 * box + side) : nullptr;
+            double& yty = system.triangle_yty[2 * box + side];
+            for (int i = i_begin; i < i_end && pixel[side] < design.num_pixels; ++i, ++pixel[side])
+            {
+                const double* basis = &design.basis[(size_t)pixel[side] * num_control_points];
+                double weight = (weight_row) ? weight_row[i] : 1.0;
+                for (int c = 0; c < 3; ++c)
+                {
+                    double color = rows[c][i] / 255.0;
+                    for (int k = 0; k < num_control_points; ++k) { rhs[k * 3 + c] += weight * basis[k] * color; }
+                    yty += weight * color * color;
+                }
+                if (gram)
+                {
+                    for (int k = 0; k < num_control_points; ++k)
+                    {
+                        for (int l = 0; l < num_control_points; ++l) { gram[k * num_control_points + l] += weight * basis[k] * basis[l]; }
+                    }
+                }
+            }
+        });
+    });
+
+    std::vector<double> control_points;
+    system.warm_start(coloring_pool(), control_points);
+    report = system.solve(coloring_pool(), control_points, global_fit_tolerance, global_fit_max_iterations);
+
+    coloring_pool().parallel_for(0, x_max * y_max, [&](int box)
+    {
+        for (int side = 0; side < 2; ++side)
+        {
+            int basee = box * 6 + side * 3;
+            for (int k = 0; k < num_control_points; ++k)
+            {
+                const double* node = &control_points[(size_t)system.node(box, side, k) * 3];
+                for (int c = 0; c < 3; ++c) { triangle_colors[k][basee + c] = (float)node[c]; }
+            }
+            if (coloring_info.triangle_errors) { coloring_info.triangle_errors[box * 2 + side] = (float)system.squared_error(box, side, control_points); }
+        }
+    });
 }
 
 //  ----------------------------------------------------------------------------------------------------------
@@ -1120,50 +2384,11 @@ void update_index_buffer(int num_triangles_x, int num_triangles_y, unsigned int
 
 //  ----------------------------------------------------------------------------------------------------------
 // | computes the saliency map from the image buffer given the selected saliency mode (from the imgui window) |
+// | (or takes it from the cache when this image and mode were used before, see saliency_cache)               |
 //  ----------------------------------------------------------------------------------------------------------
 void update_saliency_map(const cv::Mat& img, cv::Mat& saliency_map, int saliency_mode)
 {
-    // fine_grained: more detailed, per pixel saliency map (recommended)
-    // spectral_residual: less detail, more blocky saliency map
-    switch (saliency_mode)
-    {
-        case saliency_method::fine_grained:
-        {
-            auto saliency_alg = cv::saliency::StaticSaliencyFineGrained::create();
-            saliency_alg->computeSaliency(img, saliency_map);
-            break;
-        }
-        case saliency_method::spectral_residual:
-        {
-            auto saliency_alg = cv::saliency::StaticSaliencySpectralResidual::create();
-            saliency_alg->computeSaliency(img, saliency_map);
-            break;
-        }
-    }
-}
-
-//  -----------------------------------------------------------
-// | uses opencv to generate an edge map of the provided image |
-//  -----------------------------------------------------------
-void get_edges(const cv::Mat& img, cv::Mat& edges, int low_threshold)
-{
-    // cv::Mat img_gray;
-    // const int ratios = 3;
-    // const int kernel_size = 3;
-    // cv::cvtColor(img, img_gray, cv::COLOR_BGR2GRAY);
-    // cv::blur(img_gray, edges, cv::Size(3, 3));
-    // cv::Canny(edges, edges, low_threshold, low_threshold * ratios, kernel_size);
-
-    // can still be improved a lot
-    cv::Mat img_filtered;
-    cv::Mat img_gray;
-    cv::bilateralFilter(img, img_filtered, 9, 75, 75);
-    cv::medianBlur(img_filtered, img_filtered, 5);
-    cv::cvtColor(img_filtered, edges, cv::COLOR_BGR2GRAY);
-    // cv::blur(img_gray_filtered, edges, cv::Size(3, 3));
-    const int ratios = 3;
-    const int kernel_size = 3;
-    cv::Canny(edges, edges, low_threshold, low_threshold * ratios, kernel_size);
+    saliency_map = saliency_maps().get(img, saliency_mode);
 }
 
 //  --------------------------------------------------
@@ -1236,3 +2461,8 @@ static void glfw_error_callback(int error, const char* description)
 {
     fprintf(stderr, "Glfw Error %d: %s\n", error, description);
 }
+
+static void gsl_error_callback(const char* reason, const char* file, int line, int gsl_errno)
+{
+    fprintf(stderr, "Gsl Error %d (%s:%d): %s\n", gsl_errno, file, line, reason);
+}
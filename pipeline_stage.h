@@ -0,0 +1,41 @@
+#pragma once
+
+#include <tuple>
+#include <chrono>
+
+//  ------------------------------------------------------------------------------------------------------------------------------
+// | one stage of the recalculation pipeline of main (decode -> flip -> saliency -> edges -> gather -> fit -> upload)            |
+// | the key of a stage is everything its result depends on: its own settings and the versions of the stages it reads; the stage |
+// | only reruns when the key differs from the one of its last run (or it was never run), and every run increments its version,  |
+// | so the stages downstream of it see the change in their keys and rerun too, while the stages upstream keep their results     |
+//  ------------------------------------------------------------------------------------------------------------------------------
+template <typename... key_types>
+class pipeline_stage
+{
+    public:
+        typedef std::tuple<key_types...> key_type;
+
+        unsigned long long version = 0; // number of runs, part of the keys of the stages downstream
+        double ms = 0.0; // time the last run took
+
+        // true when the stage has to rerun for new_key (dirty flag)
+        bool dirty(const key_type& new_key) const { return !valid || !(new_key == key); }
+
+        // func() (timed) when the stage is dirty for new_key; returns if it ran
+        template <typename function>
+        bool run(const key_type& new_key, function&& func)
+        {
+            if (!dirty(new_key)) { return false; }
+            auto start = std::chrono::steady_clock::now();
+            func();
+            ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            key = new_key;
+            valid = true;
+            ++version;
+            return true;
+        }
+
+    private:
+        key_type key;
+        bool valid = false;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "color_kernels.h"
+
+// one row of the planes used for a (weighted) color sum: r, g, b are w*R, w*G, w*B (or R, G, B) and w the weight (or 1)
+// r_unweighted, g_unweighted, b_unweighted are always R, G, B (for the squared colors w*R*R, see planar_sums)
+struct planar_row
+{
+    const float* r;
+    const float* g;
+    const float* b;
+    const float* w;
+    const float* r_unweighted;
+    const float* g_unweighted;
+    const float* b_unweighted;
+};
+
+//  ------------------------------------------------------------------------------------------------------------------------------
+// | float copy of an image and its saliency map in planar (one array per channel) layout, built once per image/saliency mode    |
+// | planes: R, G, B (unweighted, range [0, 255]), w*R, w*G, w*B and w (w = saliency value + bias, so the bias is already applied) |
+// | the coloring methods read their pixels from here instead of converting the BGR8 pixels of the image over and over again     |
+//  ------------------------------------------------------------------------------------------------------------------------------
+class planar_color_image
+{
+    public:
+        enum plane { red, green, blue, red_weighted, green_weighted, blue_weighted, weight, num_planes };
+
+        int rows = 0;
+        int cols = 0;
+
+        void build(const cv::Mat& img, const cv::Mat& saliency_map, float saliency_bias)
+        {
+            CV_Assert(saliency_map.type() == CV_32F && saliency_map.size() == img.size());
+            rows = img.rows;
+            cols = img.cols;
+            planes.resize((size_t)num_planes * rows * cols);
+            ones.assign(cols, 1.0f);
+
+            const color_kernels& kernels = active_color_kernels();
+            for (int y = 0; y < rows; ++y)
+            {
+                planar_span out = {plane_row(red, y), plane_row(green, y), plane_row(blue, y), plane_row(red_weighted, y), plane_row(green_weighted, y), plane_row(blue_weighted, y), plane_row(weight, y)};
+                kernels.to_planar(img.ptr<unsigned char>(y), saliency_map.ptr<float>(y), cols, saliency_bias, out);
+            }
+        }
+
+        bool empty() const { return planes.empty(); }
+
+        float* plane_row(plane p, int y) { return &planes[((size_t)p * rows + y) * cols]; }
+        const float* plane_row(plane p, int y) const { return &planes[((size_t)p * rows + y) * cols]; }
+
+        // the planes to sum for the weighted (saliency) or the plain average color
+        planar_row row(int y, bool weighted) const
+        {
+            if (weighted) { return {plane_row(red_weighted, y), plane_row(green_weighted, y), plane_row(blue_weighted, y), plane_row(weight, y), plane_row(red, y), plane_row(green, y), plane_row(blue, y)}; }
+            return {plane_row(red, y), plane_row(green, y), plane_row(blue, y), ones.data(), plane_row(red, y), plane_row(green, y), plane_row(blue, y)};
+        }
+
+        // unweighted color of pixel (x, y) in the range [0, 1]
+        void color(int x, int y, float color[3]) const
+        {
+            color[0] = plane_row(red, y)[x] / 255.0f;
+            color[1] = plane_row(green, y)[x] / 255.0f;
+            color[2] = plane_row(blue, y)[x] / 255.0f;
+        }
+
+    private:
+        std::vector<float> planes; // plane after plane, each rows x cols
+        std::vector<float> ones; // weight row of the unweighted planes
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <tuple>
+#include <cstdint>
+#include <cstring>
+
+#include <opencv2/core.hpp>
+#include <opencv2/saliency.hpp>
+
+enum saliency_method { fine_grained, spectral_residual };
+
+//  ------------------------------------------------------------------------------------------------------------------------------
+// | least recently used cache of saliency maps, keyed by (hash of the image content, image size, saliency method), so going     |
+// | back to an image or saliency method that was used before does not compute its saliency map again                             |
+// | holds at most max_bytes of maps (the least recently used ones are dropped first); one instance of every saliency algorithm  |
+// | is created once and reused for every map                                                                                     |
+//  ------------------------------------------------------------------------------------------------------------------------------
+class saliency_cache
+{
+    public:
+        explicit saliency_cache(size_t max_bytes) : max_bytes(max_bytes) {}
+
+        // saliency map of img (CV_32F, range [0, 1], whatever the algorithm returns) for the method; the returned map shares
+        // its data with the cache
+        cv::Mat get(const cv::Mat& img, int method)
+        {
+            key map_key = {content_hash(img), img.rows, img.cols, method};
+            auto found = index.find(map_key);
+            if (found != index.end())
+            {
+                entries.splice(entries.begin(), entries, found->second); // now the most recently used
+                ++num_hits;
+                return found->second->map;
+            }
+
+            cv::Mat saliency_map;
+            algorithm(method)->computeSaliency(img, saliency_map);
+            // fine grained gives CV_8U in [0, 255], spectral residual CV_32F in [0, 1]
+            if (saliency_map.depth() != CV_32F) { saliency_map.convertTo(saliency_map, CV_32F, (saliency_map.depth() == CV_8U) ? 1.0 / 255.0 : 1.0); }
+            ++num_misses;
+
+            entries.push_front({map_key, saliency_map});
+            index[map_key] = entries.begin();
+            used_bytes += map_bytes(saliency_map);
+            while (used_bytes > max_bytes && entries.size() > 1)
+            {
+                used_bytes -= map_bytes(entries.back().map);
+                index.erase(entries.back().map_key);
+                entries.pop_back();
+            }
+            return saliency_map;
+        }
+
+        int hits() const { return num_hits; }
+        int misses() const { return num_misses; }
+        size_t size() const { return entries.size(); }
+        size_t bytes() const { return used_bytes; }
+
+        // 64 bit hash of the pixels of img (8 bytes at a time, rows one by one so views into bigger images work too)
+        static uint64_t content_hash(const cv::Mat& img)
+        {
+            uint64_t hash = 0x9E3779B97F4A7C15ull ^ ((uint64_t)img.type() << 32);
+            size_t row_bytes = img.cols * img.elemSize();
+            for (int y = 0; y < img.rows; ++y)
+            {
+                const unsigned char* row = img.ptr<unsigned char>(y);
+                size_t i = 0;
+                for (; i + 8 <= row_bytes; i += 8)
+                {
+                    uint64_t word;
+                    std::memcpy(&word, row + i, 8);
+                    hash = mix(hash ^ word);
+                }
+                uint64_t rest = 0;
+                std::memcpy(&rest, row + i, row_bytes - i);
+                hash = mix(hash ^ rest ^ ((uint64_t)y << 48));
+            }
+            return hash;
+        }
+
+    private:
+        struct key
+        {
+            uint64_t hash;
+            int rows;
+            int cols;
+            int method;
+
+            bool operator<(const key& other) const { return std::tie(hash, rows, cols, method) < std::tie(other.hash, other.rows, other.cols, other.method); }
+        };
+        struct entry
+        {
+            key map_key;
+            cv::Mat map;
+        };
+
+        size_t max_bytes;
+        size_t used_bytes = 0;
+        int num_hits = 0;
+        int num_misses = 0;
+        std::list<entry> entries; // most recently used first
+        std::map<key, std::list<entry>::iterator> index;
+        cv::Ptr<cv::saliency::StaticSaliency> algorithms[2];
+
+        static size_t map_bytes(const cv::Mat& map) { return map.total() * map.elemSize(); }
+
+        // fine_grained: more detailed, per pixel saliency map (recommended)
+        // spectral_residual: less detail, more blocky saliency map
+        cv::Ptr<cv::saliency::StaticSaliency>& algorithm(int method)
+        {
+            cv::Ptr<cv::saliency::StaticSaliency>& instance = algorithms[(method == saliency_method::spectral_residual) ? 1 : 0];
+            if (!instance)
+            {
+                if (method == saliency_method::spectral_residual) { instance = cv::saliency::StaticSaliencySpectralResidual::create(); }
+                else { instance = cv::saliency::StaticSaliencyFineGrained::create(); }
+            }
+            return instance;
+        }
+
+        // final step of splitmix64
+        static uint64_t mix(uint64_t x)
+        {
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+            return x ^ (x >> 31);
+        }
+};
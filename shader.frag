@@ -6,6 +6,7 @@ in vec3 coord;
 
 // uniform vec4 weight;
 uniform int mode;
+uniform int show_error_map; // the heat map is already mixed into the colors (see mix_error_map in main.cpp)
 const int constant_color_avg = 0;
 const int constant_color_center = 1;
 const int bilinear_interpolation_no_opt = 2;
@@ -15,8 +16,10 @@ const int bilinear_interpolation_opt = 5;
 const int biquadratic_interpolation = 6;
 const int bicubic_interpolation = 7;
 const int biquartic_interpolation = 8;
+const int adaptive_interpolation = 9;
 
 const int triangles_per_side = 52;
+const float adaptive_degree_marker = -1e30f; // same as in main.cpp
 
 // main color (r, g, b)
 uniform variables1 {
@@ -62,6 +65,8 @@ uniform variables13 {
 uniform variables14 {
   float var14[triangles_per_side * triangles_per_side * 2 * 3];
 };
+// last control point of the biquartic interpolation; an adaptive interpolation triangle of a lower degree does not use it,
+// so it holds adaptive_degree_marker and the degree of the triangle instead
 uniform variables15 {
   float var15[triangles_per_side * triangles_per_side * 2 * 3];
 };
@@ -111,6 +116,8 @@ void main()
     // ---------------------------------------------------------------------
     case bilinear_interpolation_no_opt:
       color = coord.x * colours[0] + coord.y * colours[1] + coord.z * colours[2];
+      // the vertex colors with the heat map mixed in, per triangle, as degree 1 control points
+      if (show_error_map != 0) { color = compute_general_interpolation(1); }
       break;
     // ---------------------------------------------------------------------
     case linear_split_constant:
@@ -191,59 +198,68 @@ void main()
         color = compute_general_interpolation(4);
       }
       break;
+    // ---------------------------------------------------------------------
+    case adaptive_interpolation:
+      {
+        int degree = bezier_max_degree;
+        if (var15[gl_PrimitiveID * 3] <= adaptive_degree_marker) { degree = clamp(int(var15[(gl_PrimitiveID * 3) + 1] + 0.5f), 0, bezier_max_degree); }
+        color = compute_general_interpolation(degree);
+      }
+      break;
   }
+
   FragColor = vec4(color, 1.0);
 }
 
-float fact(in int n)
+// control point index of the bezier triangle of this primitive (only the control points of the degree that is used are read)
+vec3 get_control_point(in int index)
 {
-  float result = 1;
-  for (int i = 1; i <= n; ++i)
+  int base = gl_PrimitiveID * 3;
+  switch (index)
   {
-    result *= i;
+    case 0: return vec3(var1[base], var1[base + 1], var1[base + 2]);
+    case 1: return vec3(var2[base], var2[base + 1], var2[base + 2]);
+    case 2: return vec3(var3[base], var3[base + 1], var3[base + 2]);
+    case 3: return vec3(var4[base], var4[base + 1], var4[base + 2]);
+    case 4: return vec3(var5[base], var5[base + 1], var5[base + 2]);
+    case 5: return vec3(var6[base], var6[base + 1], var6[base + 2]);
+    case 6: return vec3(var7[base], var7[base + 1], var7[base + 2]);
+    case 7: return vec3(var8[base], var8[base + 1], var8[base + 2]);
+    case 8: return vec3(var9[base], var9[base + 1], var9[base + 2]);
+    case 9: return vec3(var10[base], var10[base + 1], var10[base + 2]);
+    case 10: return vec3(var11[base], var11[base + 1], var11[base + 2]);
+    case 11: return vec3(var12[base], var12[base + 1], var12[base + 2]);
+    case 12: return vec3(var13[base], var13[base + 1], var13[base + 2]);
+    case 13: return vec3(var14[base], var14[base + 1], var14[base + 2]);
+    default: return vec3(var15[base], var15[base + 1], var15[base + 2]);
   }
-  return result;
 }
-// pow function of glsl give weird artifacts for intperpolation because casting the exponent to float gives weird errors
-// also this is probably faster than the general case where exponent is a float
-float pow2(in float base, in int exponent)
+vec3 compute_general_interpolation(in int n)
 {
-  float res = 1.0f;
-  for (int i = 0; i < exponent; ++i)
+  // integer powers by repeated multiplication (pow of glsl gives weird artifacts for the interpolation because of the float exponent)
+  float s_pow[bezier_max_degree + 1];
+  float t_pow[bezier_max_degree + 1];
+  float u_pow[bezier_max_degree + 1];
+  s_pow[0] = 1.0f;
+  t_pow[0] = 1.0f;
+  u_pow[0] = 1.0f;
+  for (int e = 1; e <= n; ++e)
   {
-    res *= base;
+    s_pow[e] = s_pow[e - 1] * coord.x;
+    t_pow[e] = t_pow[e - 1] * coord.y;
+    u_pow[e] = u_pow[e - 1] * coord.z;
   }
-  return res;
-}
-vec3 compute_general_interpolation(in int n)
-{
-  vec3 control_points[15];
-  control_points[0] = vec3(var1[gl_PrimitiveID * 3], var1[(gl_PrimitiveID * 3) + 1], var1[(gl_PrimitiveID * 3) + 2]);
-  control_points[1] = vec3(var2[gl_PrimitiveID * 3], var2[(gl_PrimitiveID * 3) + 1], var2[(gl_PrimitiveID * 3) + 2]);
-  control_points[2] = vec3(var3[gl_PrimitiveID * 3], var3[(gl_PrimitiveID * 3) + 1], var3[(gl_PrimitiveID * 3) + 2]);
-  control_points[3] = vec3(var4[gl_PrimitiveID * 3], var4[(gl_PrimitiveID * 3) + 1], var4[(gl_PrimitiveID * 3) + 2]);
-  control_points[4] = vec3(var5[gl_PrimitiveID * 3], var5[(gl_PrimitiveID * 3) + 1], var5[(gl_PrimitiveID * 3) + 2]);
-  control_points[5] = vec3(var6[gl_PrimitiveID * 3], var6[(gl_PrimitiveID * 3) + 1], var6[(gl_PrimitiveID * 3) + 2]);
-  control_points[6] = vec3(var7[gl_PrimitiveID * 3], var7[(gl_PrimitiveID * 3) + 1], var7[(gl_PrimitiveID * 3) + 2]);
-  control_points[7] = vec3(var8[gl_PrimitiveID * 3], var8[(gl_PrimitiveID * 3) + 1], var8[(gl_PrimitiveID * 3) + 2]);
-  control_points[8] = vec3(var9[gl_PrimitiveID * 3], var9[(gl_PrimitiveID * 3) + 1], var9[(gl_PrimitiveID * 3) + 2]);
-  control_points[9] = vec3(var10[gl_PrimitiveID * 3], var10[(gl_PrimitiveID * 3) + 1], var10[(gl_PrimitiveID * 3) + 2]);
-  control_points[10] = vec3(var11[gl_PrimitiveID * 3], var11[(gl_PrimitiveID * 3) + 1], var11[(gl_PrimitiveID * 3) + 2]);
-  control_points[11] = vec3(var12[gl_PrimitiveID * 3], var12[(gl_PrimitiveID * 3) + 1], var12[(gl_PrimitiveID * 3) + 2]);
-  control_points[12] = vec3(var13[gl_PrimitiveID * 3], var13[(gl_PrimitiveID * 3) + 1], var13[(gl_PrimitiveID * 3) + 2]);
-  control_points[13] = vec3(var14[gl_PrimitiveID * 3], var14[(gl_PrimitiveID * 3) + 1], var14[(gl_PrimitiveID * 3) + 2]);
-  control_points[14] = vec3(var15[gl_PrimitiveID * 3], var15[(gl_PrimitiveID * 3) + 1], var15[(gl_PrimitiveID * 3) + 2]);
 
+  // multinomial coefficients come from the tables the program inserts above (see bezier_glsl_tables)
   int index = 0;
-  float numerator = fact(n);
+  int offset = bezier_table_offset[n];
   vec3 res_color = vec3(0.0f, 0.0f, 0.0f);
   for (int i = 0; i <= n; ++i)
   {
       for (int j = 0; i+j <= n; ++j)
       {
           int k = n - i - j;
-          float multiplier = (numerator / (fact(i) * fact(j) * fact(k)));
-          res_color += control_points[index] * multiplier * pow2(coord.x, i) * pow2(coord.y, j) * pow2(coord.z, k);
+          res_color += get_control_point(index) * bezier_multinomial[offset + index] * s_pow[i] * t_pow[j] * u_pow[k];
           ++index;
       }
   }
@@ -10,11 +10,12 @@ class Shader
     public:
         unsigned int ID;
     
-        Shader(const char* vertex_path, const char* geometry_path, const char* fragment_path)
+        // fragment_prelude: generated declarations that are inserted in the fragment shader right after its #version line
+        Shader(const char* vertex_path, const char* geometry_path, const char* fragment_path, const std::string& fragment_prelude = "")
         {
             unsigned int vertexShader = load_shader(vertex_path, GL_VERTEX_SHADER);
             unsigned int geometryShader = load_shader(geometry_path, GL_GEOMETRY_SHADER);
-            unsigned int fragmentShader = load_shader(fragment_path, GL_FRAGMENT_SHADER);
+            unsigned int fragmentShader = load_shader(fragment_path, GL_FRAGMENT_SHADER, fragment_prelude);
         
             ID = glCreateProgram();
             glAttachShader(ID, vertexShader);
@@ -54,12 +55,17 @@ class Shader
         }
     
     private:
-        unsigned int load_shader(std::string path, GLenum type)
+        unsigned int load_shader(std::string path, GLenum type, const std::string& prelude = "")
         {
             std::ifstream t (path);
             std::stringstream buffer;
             buffer << t.rdbuf();
             std::string source_string = buffer.str();
+            if (!prelude.empty())
+            {
+                size_t version_end = source_string.find('\n');
+                source_string.insert((version_end == std::string::npos) ? source_string.size() : version_end + 1, prelude);
+            }
             const char* source_code = source_string.c_str();
             unsigned int shader;
             shader = glCreateShader(type);
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+
+// what one worker did during the last parallel_for_stealing (utilization = busy_ms / wall_ms)
+struct worker_stats
+{
+    double busy_ms = 0.0; // time spent running tasks
+    double wall_ms = 0.0; // time the whole parallel_for_stealing took
+    int tasks = 0;
+    int steals = 0;
+};
+
+//  ------------------------------------------------------------------------------------------------------------------------------
+// | persistent pool of worker threads for the coloring methods (the calling thread is worker 0, so size() == 1 runs serially)   |
+// | the threads live as long as the pool, so their thread_local scratch buffers are reused between recalculations                |
+// | parallel_for splits the range in size() contiguous chunks; every index is run exactly once by one worker, so as long as the  |
+// | iterations write disjoint results the output does not depend on the number of threads                                       |
+// | parallel_for_stealing is for ranges where the cost per index varies a lot: every worker starts with a contiguous chunk and   |
+// | takes its tasks one at a time from the front; a worker that runs out steals the back half of the remaining tasks of another  |
+//  ------------------------------------------------------------------------------------------------------------------------------
+class thread_pool
+{
+    public:
+        explicit thread_pool(int num_threads = 1) { resize(num_threads); }
+        ~thread_pool() { stop_workers(); }
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        int size() const { return num_threads; }
+
+        // total number of threads (including the calling thread); restarts the workers if the size changes
+        void resize(int new_num_threads)
+        {
+            new_num_threads = std::max(new_num_threads, 1);
+            if (new_num_threads == num_threads && (int)workers.size() == num_threads - 1) { return; }
+
+            stop_workers();
+            num_threads = new_num_threads;
+            stopping = false;
+            for (int worker = 1; worker < num_threads; ++worker)
+            {
+                workers.emplace_back(&thread_pool::worker_loop, this, worker, generation);
+            }
+        }
+
+        // func(i) for every i in [begin, end)
+        template <typename function>
+        void parallel_for(int begin, int end, function&& func)
+        {
+            int count = end - begin;
+            if (count <= 0) { return; }
+            if (num_threads == 1 || count == 1)
+            {
+                for (int i = begin; i < end; ++i) { func(i); }
+                return;
+            }
+
+            int num_chunks = std::min(num_threads, count);
+            run([&](int worker)
+            {
+                if (worker >= num_chunks) { return; }
+                int chunk_begin = begin + (int)((long long)count * worker / num_chunks);
+                int chunk_end = begin + (int)((long long)count * (worker + 1) / num_chunks);
+                for (int i = chunk_begin; i < chunk_end; ++i) { func(i); }
+            });
+        }
+
+        // func(i) for every i in [begin, end), load balanced with work stealing; fills the stats of every worker (see get_stats)
+        template <typename function>
+        void parallel_for_stealing(int begin, int end, function&& func)
+        {
+            using clock = std::chrono::steady_clock;
+            int count = end - begin;
+            stats.assign(num_threads, worker_stats());
+            if (count <= 0) { return; }
+
+            std::unique_ptr<task_range[]> ranges(new task_range[num_threads]);
+            for (int worker = 0; worker < num_threads; ++worker)
+            {
+                ranges[worker].begin = begin + (int)((long long)count * worker / num_threads);
+                ranges[worker].end = begin + (int)((long long)count * (worker + 1) / num_threads);
+            }
+
+            auto start = clock::now();
+            run([&](int worker)
+            {
+                worker_stats& worker_stat = stats[worker];
+                int task;
+                while (true)
+                {
+                    if (!ranges[worker].pop_front(task))
+                    {
+                        if (!steal(ranges.get(), worker)) { break; }
+                        ++worker_stat.steals;
+                        continue;
+                    }
+                    auto task_start = clock::now();
+                    func(task);
+                    worker_stat.busy_ms += std::chrono::duration<double, std::milli>(clock::now() - task_start).count();
+                    ++worker_stat.tasks;
+                }
+            });
+            double wall_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+            for (worker_stats& worker_stat : stats) { worker_stat.wall_ms = wall_ms; }
+        }
+
+        // per worker stats of the last parallel_for_stealing
+        const std::vector<worker_stats>& get_stats() const { return stats; }
+
+        // job(worker) once on every worker (the calling thread included), returns when all of them are done
+        void run(const std::function<void(int)>& new_job)
+        {
+            if (workers.empty())
+            {
+                new_job(0);
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job = &new_job;
+                pending = (int)workers.size();
+                ++generation;
+            }
+            start_condition.notify_all();
+
+            new_job(0);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            done_condition.wait(lock, [&]() { return pending == 0; });
+            job = nullptr;
+        }
+
+    private:
+        int num_threads = 0;
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable start_condition;
+        std::condition_variable done_condition;
+        const std::function<void(int)>* job = nullptr;
+        unsigned long long generation = 0; // incremented for every job, so a worker knows it has a new one
+        int pending = 0; // workers that did not finish the current job yet
+        bool stopping = false;
+        std::vector<worker_stats> stats;
+
+        // tasks [begin, end) that are left for one worker (the owner takes from the front, thieves from the back)
+        struct task_range
+        {
+            std::mutex mutex;
+            int begin = 0;
+            int end = 0;
+
+            bool pop_front(int& task)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (begin >= end) { return false; }
+                task = begin++;
+                return true;
+            }
+        };
+
+        // moves the back half of the tasks of the first other worker that has any to the (empty) range of the thief
+        bool steal(task_range ranges[], int thief)
+        {
+            for (int offset = 1; offset < num_threads; ++offset)
+            {
+                task_range& victim = ranges[(thief + offset) % num_threads];
+                int stolen_begin, stolen_end;
+                {
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+                    int remaining = victim.end - victim.begin;
+                    if (remaining <= 0) { continue; }
+                    stolen_end = victim.end;
+                    stolen_begin = victim.end - (remaining + 1) / 2;
+                    victim.end = stolen_begin;
+                }
+                std::lock_guard<std::mutex> lock(ranges[thief].mutex);
+                ranges[thief].begin = stolen_begin;
+                ranges[thief].end = stolen_end;
+                return true;
+            }
+            return false;
+        }
+
+        void worker_loop(int worker, unsigned long long seen_generation)
+        {
+            while (true)
+            {
+                const std::function<void(int)>* current_job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    start_condition.wait(lock, [&]() { return stopping || generation != seen_generation; });
+                    if (stopping) { return; }
+                    seen_generation = generation;
+                    current_job = job;
+                }
+
+                (*current_job)(worker);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--pending == 0) { done_condition.notify_one(); }
+            }
+        }
+
+        void stop_workers()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            start_condition.notify_all();
+            for (std::thread& t : workers) { t.join(); }
+            workers.clear();
+        }
+};
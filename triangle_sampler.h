@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+#include "box_rasterizer.h"
+
+// settings for the (optional) subsampling of the pixels of a triangle for the average and bezier fits
+struct sampling_settings
+{
+    bool enabled = false;
+    bool use_error_bound = false; // false: target_samples per triangle, true: as many samples as needed to reach error_bound
+    int target_samples = 256;
+    float error_bound = 0.01f; // 95% confidence bound on the color error (colors in the range [0, 1])
+
+    bool operator==(const sampling_settings& other) const
+    {
+        return enabled == other.enabled && use_error_bound == other.use_error_bound && target_samples == other.target_samples && error_bound == other.error_bound;
+    }
+};
+
+// achieved accuracy of the last sampled computation (error = 95% confidence bound, colors in the range [0, 1])
+struct sampling_report
+{
+    long long num_samples = 0;
+    long long num_pixels = 0;
+    int num_triangles = 0; // triangles with an error estimate
+    double mean_error = 0.0;
+    double max_error = 0.0;
+
+    // adds the result of one triangle (error NaN = no estimate, e.g. less samples than parameters)
+    void add_triangle(int samples, int pixels, double error)
+    {
+        num_samples += samples;
+        num_pixels += pixels;
+        if (std::isnan(error)) { return; }
+        mean_error += (error - mean_error) / (num_triangles + 1);
+        max_error = std::max(max_error, error);
+        ++num_triangles;
+    }
+};
+
+const double sampling_confidence_z = 1.96; // 95% two sided
+
+// finite population correction for the standard error of num_samples samples (without replacement) out of num_pixels
+inline double finite_population_correction(int num_samples, int num_pixels)
+{
+    if (num_pixels <= 0) { return 0.0; }
+    return std::sqrt(std::max(0.0, 1.0 - (double)num_samples / (double)num_pixels));
+}
+
+// deterministic pseudo random number in [0, 1) for the given inputs (integer hash, so the same image gives the same samples)
+inline float sample_jitter(unsigned int a, unsigned int b, unsigned int stream)
+{
+    unsigned int h = (a * 0x9E3779B1u) ^ ((b + 0x7F4A7C15u) * 0x85EBCA77u) ^ (stream * 0xC2B2AE3Du);
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return (float)(h >> 8) * (1.0f / 16777216.0f);
+}
+
+// number of pixels in the left and right triangle of a box (same x + y <= 1 / x + y >= 1 test as the rest of the code)
+inline void count_triangle_pixels(const box_rasterizer& box, int counts[2])
+{
+    counts[0] = 0;
+    counts[1] = 0;
+    box.for_each_span([&](int j, int i_begin, int i_end, bool left_triangle) { counts[(left_triangle) ? 0 : 1] += i_end - i_begin; });
+}
+
+//  -----------------------------------------------------------------------------------------------------------------------------
+// | stratified (jittered grid) subset of the pixels of a box: the box is divided in cells_x x cells_y cells of the same size   |
+// | and one pixel is taken from every cell, at a position that comes from a hash of the cell and the box, so the subset is     |
+// | well spread over both triangles and the same every run; there are about 2 * samples_per_triangle cells (1 cell per pixel   |
+// | when the box has fewer pixels than that, then every pixel is used exactly once)                                            |
+//  -----------------------------------------------------------------------------------------------------------------------------
+struct box_sampler
+{
+    const box_rasterizer& box;
+    int cells_x = 0;
+    int cells_y = 0;
+
+    box_sampler(const box_rasterizer& box, int samples_per_triangle) : box(box)
+    {
+        if (box.nx <= 0 || box.ny <= 0) { return; }
+        double num_cells = 2.0 * std::max(samples_per_triangle, 1);
+        if (num_cells >= (double)box.nx * (double)box.ny)
+        {
+            cells_x = box.nx;
+            cells_y = box.ny;
+            return;
+        }
+        cells_x = std::min(std::max((int)std::lround(std::sqrt(num_cells * box.nx / box.ny)), 1), box.nx);
+        cells_y = std::min(std::max((int)std::lround(num_cells / cells_x), 1), box.ny);
+    }
+
+    bool exhaustive() const { return cells_x == box.nx && cells_y == box.ny; }
+
+    // first pixel of cell c out of num_cells along an axis with num_pixels pixels (the cells split the pixels without overlap)
+    static int cell_begin(int c, int num_cells, int num_pixels) { return (int)((long long)c * num_pixels / num_cells); }
+
+    // sample_func(i, j, in_left, in_right) for the sampled pixel (i, j) of every cell (pixels on the diagonal are in both triangles)
+    template <typename sample_function>
+    void for_each_sample(sample_function&& sample_func) const
+    {
+        unsigned int box_seed = (unsigned int)box.x0 * 73856093u ^ (unsigned int)box.y0 * 19349663u;
+        for (int cy = 0; cy < cells_y; ++cy)
+        {
+            for (int cx = 0; cx < cells_x; ++cx)
+            {
+                unsigned int cell = (unsigned int)(cx + cy * cells_x);
+                int i = cell_begin(cx, cells_x, box.nx);
+                int j = cell_begin(cy, cells_y, box.ny);
+                i += std::min((int)(sample_jitter(cell, box_seed, 0) * (cell_begin(cx + 1, cells_x, box.nx) - i)), box.nx - 1 - i);
+                j += std::min((int)(sample_jitter(cell, box_seed, 1) * (cell_begin(cy + 1, cells_y, box.ny) - j)), box.ny - 1 - j);
+                float x = box.x(i);
+                float y = box.y(j);
+                sample_func(i, j, x + y <= 1.0f, x + y >= 1.0f);
+            }
+        }
+    }
+};
+
+//  ------------------------------------------------------------------------------------------------------------------------
+// | weighted sums of sampled colors, for the weighted average and its standard error                                      |
+// | standard error of the ratio estimator sum(w*c) / sum(w): sqrt(sum(w^2 * (c - average)^2)) / sum(w)                    |
+//  ------------------------------------------------------------------------------------------------------------------------
+struct sample_moments
+{
+    int count = 0;
+    double w_sum = 0.0;
+    double w2_sum = 0.0;
+    double wc_sum[3] = {0.0, 0.0, 0.0};
+    double w2c_sum[3] = {0.0, 0.0, 0.0};
+    double w2c2_sum[3] = {0.0, 0.0, 0.0};
+    double wc2_sum = 0.0; // w (r^2 + g^2 + b^2)
+
+    // color in the range [0, 255]
+    void add(const float color[3], float w)
+    {
+        ++count;
+        w_sum += w;
+        w2_sum += (double)w * w;
+        for (int c = 0; c < 3; ++c)
+        {
+            double wc = (double)w * color[c];
+            wc_sum[c] += wc;
+            w2c_sum[c] += w * wc;
+            w2c2_sum[c] += wc * wc;
+            wc2_sum += wc * color[c];
+        }
+    }
+
+    // average color in the range [0, 1] (NaN when there are no samples)
+    void average(float average[3]) const
+    {
+        for (int c = 0; c < 3; ++c) { average[c] = (float)(wc_sum[c] / (w_sum * 255.0)); }
+    }
+
+    // sum w |y - average|^2 over the samples (r + g + b, colors in the range [0, 1])
+    double squared_error() const
+    {
+        if (!(w_sum > 0.0)) { return 0.0; }
+        double error = wc2_sum - (wc_sum[0] * wc_sum[0] + wc_sum[1] * wc_sum[1] + wc_sum[2] * wc_sum[2]) / w_sum;
+        return std::max(error, 0.0) / (255.0 * 255.0);
+    }
+
+    // 95% confidence bound of the error of the average (largest over the channels, range [0, 1]); NaN without samples
+    double error_bound(int num_pixels) const
+    {
+        if (count == 0) { return NAN; }
+        double max_variance = 0.0;
+        for (int c = 0; c < 3; ++c)
+        {
+            double mean = wc_sum[c] / w_sum;
+            double spread = std::max(0.0, w2c2_sum[c] - 2.0 * mean * w2c_sum[c] + mean * mean * w2_sum);
+            max_variance = std::max(max_variance, spread / (w_sum * w_sum));
+        }
+        return sampling_confidence_z * std::sqrt(max_variance) * finite_population_correction(count, num_pixels) / 255.0;
+    }
+};
+
+//  ------------------------------------------------------------------------------------------------------------------------
+// | 95% confidence bound of the error of a least squares fit (num_params parameters) on num_samples of the num_pixels      |
+// | pixels of a triangle; averaged over the samples the variance of the fitted color is sigma^2 * num_params / num_samples |
+// | with sigma^2 = chisq / (num_samples - num_params) the residual variance (largest over the channels, range [0, 1])      |
+// | NaN when there are not more samples than parameters                                                                     |
+//  ------------------------------------------------------------------------------------------------------------------------
+inline double fit_error_bound(const double chisq[3], int num_samples, int num_params, int num_pixels)
+{
+    if (num_samples <= num_params) { return NAN; }
+    double max_chisq = std::max(chisq[0], std::max(chisq[1], chisq[2]));
+    double sigma = std::sqrt(max_chisq / (num_samples - num_params));
+    return sampling_confidence_z * sigma * std::sqrt((double)num_params / num_samples) * finite_population_correction(num_samples, num_pixels);
+}
+
+// samples per triangle needed to bring the error bound from error (reached with num_samples) down to target_error
+inline int samples_for_error_bound(int num_samples, double error, double target_error)
+{
+    if (std::isnan(error) || error <= target_error || target_error <= 0.0) { return num_samples; }
+    double ratio = error / target_error;
+    return (int)std::min(std::ceil(num_samples * ratio * ratio), 1e9);
+}
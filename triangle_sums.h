@@ -0,0 +1,187 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "box_rasterizer.h"
+#include "planar_image.h"
+
+//  -----------------------------------------------------------------------------------------------------------------------------
+// | precomputed prefix sums of the (saliency weighted) colors of a planar image, so the sum over any grid triangle is a lookup  |
+// | channels per entry: w*R, w*G, w*B, w, w*(R^2 + G^2 + B^2) (w = saliency value + bias when use_saliency is selected,         |
+// | otherwise w = 1); the last one gives the squared error of the average color of a triangle without another pass             |
+// | box_sums:  standard integral image; box_sums(y, x) = sum of all pixels with row < y and column < x                           |
+// | diag_sums: anti-diagonal integral of the row prefix sums; diag_sums(y, x) = sum_t row_prefix(y - t, min(x + t, cols))       |
+// |            with row_prefix(y, x) = sum of the pixels in row y with column < x                                                |
+// | together they give any staircase triangle (i + j <= k in box pixel offsets) in O(1), which is exactly the left/right        |
+// | triangle when the box is square (width == height in pixels); other boxes fall back to O(rows) row span lookups             |
+//  -----------------------------------------------------------------------------------------------------------------------------
+class triangle_sum_table
+{
+    public:
+        static const int num_channels = 5;
+
+        void build(const planar_color_image& planar, bool use_saliency)
+        {
+            rows = planar.rows;
+            cols = planar.cols;
+            box_sums.assign((size_t)(rows + 1) * (cols + 1) * num_channels, 0.0);
+            diag_sums.assign((size_t)rows * (cols + 1) * num_channels, 0.0);
+
+            std::vector<double> row_prefix((size_t)(cols + 1) * num_channels, 0.0);
+            for (int y = 0; y < rows; ++y)
+            {
+                planar_row row = planar.row(y, use_saliency);
+                for (int x = 0; x < cols; ++x)
+                {
+                    double* prev = &row_prefix[(size_t)x * num_channels];
+                    double* next = prev + num_channels;
+                    next[0] = prev[0] + row.r[x];
+                    next[1] = prev[1] + row.g[x];
+                    next[2] = prev[2] + row.b[x];
+                    next[3] = prev[3] + row.w[x];
+                    next[4] = prev[4] + row.r[x] * row.r_unweighted[x] + row.g[x] * row.g_unweighted[x] + row.b[x] * row.b_unweighted[x];
+                }
+
+                for (int x = 0; x <= cols; ++x)
+                {
+                    const double* prefix = &row_prefix[(size_t)x * num_channels];
+                    double* box = box_entry(y + 1, x);
+                    const double* box_below = box_entry(y, x);
+                    double* diag = diag_entry(y, x);
+                    const double* diag_below = (y > 0) ? diag_entry(y - 1, std::min(x + 1, cols)) : nullptr;
+                    for (int c = 0; c < num_channels; ++c)
+                    {
+                        box[c] = box_below[c] + prefix[c];
+                        diag[c] = prefix[c] + ((diag_below) ? diag_below[c] : 0.0);
+                    }
+                }
+            }
+        }
+
+        bool empty() const { return box_sums.empty(); }
+
+        //  --------------------------------------------------------------------------------------------------------------------
+        // | sums[5] = {w*R, w*G, w*B, w, w*(R^2 + G^2 + B^2)} of the pixels in the left/right triangle of the given box         |
+        // | uses the same x + y <= 1 / x + y >= 1 test (in box coordinates) as get_pixels_in_triangle                          |
+        //  --------------------------------------------------------------------------------------------------------------------
+        void triangle_sums(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, bool left_triangle, double sums[num_channels]) const
+        {
+            int x0 = (int)std::floor(bottom_left_x_pixels);
+            int y0 = (int)std::floor(bottom_left_y_pixels);
+            int nx = (int)std::ceil(width_triangle_pixels);
+            int ny = (int)std::ceil(height_triangle_pixels);
+            std::fill(sums, sums + num_channels, 0.0);
+
+            if (width_triangle_pixels != height_triangle_pixels)
+            {
+                box_rasterizer box(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, cols, rows);
+                box.for_each_span([&](int j, int i_begin, int i_end, bool left_span)
+                {
+                    if (left_span == left_triangle) { add_row_span(box.y0 + j, box.x0 + i_begin, box.x0 + i_end, sums); }
+                });
+                return;
+            }
+
+            // square box: x + y <= 1 <=> i + j <= floor(w) - 1 and x + y >= 1 <=> i + j >= ceil(w) - 1
+            if (left_triangle)
+            {
+                add_staircase(x0, y0, (int)std::floor(width_triangle_pixels) - 1, 1.0, sums);
+            }
+            else
+            {
+                add_rectangle(x0, y0, x0 + nx, y0 + ny, sums);
+                add_staircase(x0, y0, (int)std::ceil(width_triangle_pixels) - 2, -1.0, sums);
+            }
+        }
+
+        //  ---------------------------------------------------------------------------------------------------
+        // | same result as get_average_color over the left/right triangle of the box (color range is [0, 1]) |
+        // | squared_error (optional) gets sum w |y - average|^2 = sum w y^2 - (sum w y)^2 / sum w (r + g + b)  |
+        //  ---------------------------------------------------------------------------------------------------
+        void triangle_average(float bottom_left_x_pixels, float bottom_left_y_pixels, float width_triangle_pixels, float height_triangle_pixels, bool left_triangle, float average[3], double* squared_error = nullptr) const
+        {
+            double sums[num_channels];
+            triangle_sums(bottom_left_x_pixels, bottom_left_y_pixels, width_triangle_pixels, height_triangle_pixels, left_triangle, sums);
+            average[0] = (float)(sums[0] / (sums[3] * 255.0));
+            average[1] = (float)(sums[1] / (sums[3] * 255.0));
+            average[2] = (float)(sums[2] / (sums[3] * 255.0));
+            if (squared_error)
+            {
+                double error = (sums[3] > 0.0) ? sums[4] - (sums[0] * sums[0] + sums[1] * sums[1] + sums[2] * sums[2]) / sums[3] : 0.0;
+                *squared_error = std::max(error, 0.0) / (255.0 * 255.0);
+            }
+        }
+
+    private:
+        int rows = 0;
+        int cols = 0;
+        std::vector<double> box_sums;
+        std::vector<double> diag_sums;
+
+        double* box_entry(int y, int x) { return &box_sums[((size_t)y * (cols + 1) + x) * num_channels]; }
+        const double* box_entry(int y, int x) const { return &box_sums[((size_t)y * (cols + 1) + x) * num_channels]; }
+        double* diag_entry(int y, int x) { return &diag_sums[((size_t)y * (cols + 1) + x) * num_channels]; }
+        const double* diag_entry(int y, int x) const { return &diag_sums[((size_t)y * (cols + 1) + x) * num_channels]; }
+
+        int clamp_x(int x) const { return std::min(std::max(x, 0), cols); }
+        int clamp_y(int y) const { return std::min(std::max(y, 0), rows); }
+
+        // sums += (pixels with x_begin <= column < x_end and y_begin <= row < y_end)
+        void add_rectangle(int x_begin, int y_begin, int x_end, int y_end, double sums[num_channels]) const
+        {
+            x_begin = clamp_x(x_begin);
+            x_end = clamp_x(x_end);
+            y_begin = clamp_y(y_begin);
+            y_end = clamp_y(y_end);
+            if (x_end <= x_begin || y_end <= y_begin) { return; }
+
+            const double* a = box_entry(y_end, x_end);
+            const double* b = box_entry(y_end, x_begin);
+            const double* c = box_entry(y_begin, x_end);
+            const double* d = box_entry(y_begin, x_begin);
+            for (int ch = 0; ch < num_channels; ++ch)
+            {
+                sums[ch] += a[ch] - b[ch] - c[ch] + d[ch];
+            }
+        }
+
+        void add_row_span(int y, int x_begin, int x_end, double sums[num_channels]) const
+        {
+            add_rectangle(x_begin, y, x_end, y + 1, sums);
+        }
+
+        // sums += sign * (pixels (x0 + i, y0 + j) with i >= 0, j >= 0 and i + j <= k)
+        void add_staircase(int x0, int y0, int k, double sign, double sums[num_channels]) const
+        {
+            if (k < 0) { return; }
+            int y_top = std::min(y0 + k, rows - 1);
+
+            // sum_{j} row_prefix(y0 + j, x0 + k + 1 - j) - row_prefix(y0 + j, x0) over the rows y0 <= y0 + j <= y_top
+            double part[num_channels] = {};
+            const double* diag_top = diag_entry(y_top, clamp_x(x0 + k + 1 - (y_top - y0)));
+            for (int ch = 0; ch < num_channels; ++ch) { part[ch] += diag_top[ch]; }
+            if (y0 > 0)
+            {
+                const double* diag_below = diag_entry(y0 - 1, clamp_x(x0 + k + 2));
+                for (int ch = 0; ch < num_channels; ++ch) { part[ch] -= diag_below[ch]; }
+            }
+            add_rectangle(0, y0, x0, y_top + 1, part, -1.0);
+
+            for (int ch = 0; ch < num_channels; ++ch)
+            {
+                sums[ch] += sign * part[ch];
+            }
+        }
+
+        void add_rectangle(int x_begin, int y_begin, int x_end, int y_end, double sums[num_channels], double sign) const
+        {
+            double rect[num_channels] = {};
+            add_rectangle(x_begin, y_begin, x_end, y_end, rect);
+            for (int ch = 0; ch < num_channels; ++ch)
+            {
+                sums[ch] += sign * rect[ch];
+            }
+        }
+};